@@ -10,6 +10,11 @@
 #include "vtkImageData.h"
 #include <QtGui>
 
+#include "vtkCamera.h"
+#include "vtkCommand.h"
+#include "vtkProperty.h"
+#include "vtkRenderer.h"
+
 
 #include "PCarvingAlgorithm.h"
 
@@ -28,7 +33,20 @@ PBrainExtractor::PBrainExtractor()
 
 PBrainExtractor::~PBrainExtractor()
 {
-
+    delete liveWire;
+    wirePoints->Delete();
+    wireLines->Delete();
+    wirePath->Delete();
+    wireMapper->Delete();
+    wireActor->Delete();
+    for (int axis = 0; axis < 3; axis++)
+    {
+        carvingPoints[axis]->Delete();
+        carvingVerts[axis]->Delete();
+        carvingData[axis]->Delete();
+        carvingMapper[axis]->Delete();
+        carvingActor[axis]->Delete();
+    }
 }
 
 
@@ -36,6 +54,33 @@ PBrainExtractor::~PBrainExtractor()
 
 void PBrainExtractor::addWidgets()
 {
+    liveWire = new LiveWire;
+    
+    wirePoints = vtkPoints::New();
+    wireLines = vtkCellArray::New();
+    wirePath = vtkPolyData::New();
+    wirePath->SetPoints(wirePoints);
+    wirePath->SetLines(wireLines);
+    wireMapper = vtkPolyDataMapper::New();
+    wireMapper->SetInput(wirePath);
+    wireActor = vtkActor::New();
+    wireActor->GetProperty()->SetColor(0.0, 1.0, 0.0);
+    wireActor->SetMapper(wireMapper);
+    
+    for (int axis = 0; axis < 3; axis++)
+    {
+        carvingPoints[axis] = vtkPoints::New();
+        carvingVerts[axis] = vtkCellArray::New();
+        carvingData[axis] = vtkPolyData::New();
+        carvingData[axis]->SetPoints(carvingPoints[axis]);
+        carvingData[axis]->SetVerts(carvingVerts[axis]);
+        carvingMapper[axis] = vtkPolyDataMapper::New();
+        carvingMapper[axis]->SetInput(carvingData[axis]);
+        carvingActor[axis] = vtkActor::New();
+        carvingActor[axis]->GetProperty()->SetColor(1.0, 1.0, 0.0);
+        carvingActor[axis]->GetProperty()->SetPointSize(2);
+        carvingActor[axis]->SetMapper(carvingMapper[axis]);
+    }
 }
 
 
@@ -48,6 +93,15 @@ void PBrainExtractor::addActions()
     extractBrainAction->setCheckable(true);
     connect(extractBrainAction, SIGNAL(triggered()),
         this, SLOT(showBrainExtractionDialog()));
+    
+    liveWireAction = new QAction(tr("Live Wire"), this);
+    liveWireAction->setIcon(QIcon(":/images/cut.png"));
+    liveWireAction->setShortcut(tr("Ctrl+W"));
+    liveWireAction->setStatusTip(
+        tr("Click seeds on the transverse view, the wire follows the mouse."));
+    liveWireAction->setCheckable(true);
+    connect(liveWireAction, SIGNAL(toggled(bool)),
+        this, SLOT(setLiveWire(bool)));
 }
 
 
@@ -56,6 +110,7 @@ void PBrainExtractor::addMenus()
     brainMenu = new QMenu(tr("Brain"));
     menuBar()->insertMenu(outputMenu->menuAction(), brainMenu);
     brainMenu->addAction(extractBrainAction);
+    brainMenu->addAction(liveWireAction);
 }
 
 
@@ -64,12 +119,16 @@ void PBrainExtractor::addToolBars()
     addToolBarBreak();
     brainToolBar = addToolBar(tr("Brain"));
     brainToolBar->addAction(extractBrainAction);
+    brainToolBar->addAction(liveWireAction);
 }
 
 
 //----- Slot functions ----------
 void PBrainExtractor::showBrainExtractionDialog()
 {
+    if (!loaded)
+        return;
+    
     // vtkImageData *data = vtkImageData::New();
     // data->ShallowCopy(reader->GetOutput());
     int x1 = 164, y1 = 172, z1 = 105;
@@ -78,26 +137,133 @@ void PBrainExtractor::showBrainExtractionDialog()
     int x3 = 168, y3 = 190, z3 = 88;
     int x4 = 181, y4 = 201, z4 = z3;
     vtkImageData *data = reader->GetOutput();
-    dijkstra2D (data, x1, y1, x2, y2, z1);
-    return;
-    dijkstra2D (data, x3, y3, x4, y4, z3);
     
-    // dijkstra3D (data, x1, y1, z1, x3, y3, z3);
-    // dijkstra3D (data, x2, y2, z2, x4, y4, z4);
-    std::vector<Pos3D> boundary1;
-    std::vector<Pos3D> boundary2;
+    // the surface spanned by the curve of (x1, y1) - (x2, y2) on z1 and the
+    // one of (x3, y3) - (x4, y4) on z3
+    PSurfaceCarver carver;
+    std::vector< std::vector<Pos3D> > surface;
+    carver.carve (data, Pos3D(x1, y1, z1), Pos3D(x2, y2, z2), Pos3D(x3, y3, z3), Pos3D(x4, y4, z4), surface);
     
-    averageRank3D (data, x1, y1, z1, x3, y3, z3, boundary1);
-    averageRank3D (data, x2, y2, z2, x4, y4, z4, boundary2);
+    // the volume is left as it was read, the surface is only shown over it,
+    // so carving again needs no reload
+    carving.clear();
+    drawSurface(carving, surface);
+    vtkImageViewer2 *viewers[3] = { sagittalViewer, coronalViewer, transViewer };
+    for (int axis = 0; axis < 3; axis++)
+        viewers[axis]->GetRenderer()->AddActor(carvingActor[axis]);
+    updateViewers();
+}
+
+
+void PBrainExtractor::setLiveWire(bool on)
+{
+    if (!loaded)
+    {
+        liveWireAction->setChecked(false);
+        return;
+    }
     
-    for (unsigned i = 0; i < boundary1.size(); i++)
+    liveWire->stop();
+    wireFixed.clear();
+    drawWire(std::vector<Pos3D>());
+    if (on)
+        transViewer->GetRenderer()->AddActor(wireActor);
+    else
+        transViewer->GetRenderer()->RemoveActor(wireActor);
+    transViewer->Render();
+}
+
+
+//----- Supporting functions ----------
+
+bool PBrainExtractor::capturesPicks(vtkImageViewer2 *viewer)
+{
+    return liveWireAction->isChecked() && viewer == transViewer;
+}
+
+
+// A click fixes the wire up to the click and seeds a new tree there,
+// moving the mouse only traces the tree grown from the last seed.
+void PBrainExtractor::pickEvent(vtkImageViewer2 *viewer,
+    unsigned long eventId, double *pos)
+{
+    std::vector<Pos3D> live;
+    if (eventId == vtkCommand::LeftButtonPressEvent)
+    {
+        if (liveWire->trace(pos[0], pos[1], live))
+            wireFixed.insert(wireFixed.end(), live.rbegin(), live.rend());
+        liveWire->setSeed(reader->GetOutput(), pos[0], pos[1], pos[2]);
+        live.clear();
+    }
+    else if (eventId == vtkCommand::MouseMoveEvent)
+    {
+        if (!liveWire->hasSeed() || !liveWire->trace(pos[0], pos[1], live))
+            return;
+    }
+    else
+        return;
+    
+    drawWire(live);
+    transViewer->Render();
+}
+
+
+// The fixed segments and the live one, as polylines just in front of
+// the slice, where the cross hair is drawn too.
+void PBrainExtractor::drawWire(const std::vector<Pos3D> &live)
+{
+    vtkImageData *data = reader->GetOutput();
+    double *spacing = data->GetSpacing();
+    vtkCamera *camera = transViewer->GetRenderer()->GetActiveCamera();
+    double top = (camera->GetFocalPoint()[2] + camera->GetPosition()[2]) / 2;
+    
+    wirePoints->Reset();
+    wireLines->Reset();
+    const std::vector<Pos3D> *parts[2] = { &wireFixed, &live };
+    for (int k = 0; k < 2; k++)
     {
-        std::cout << "(" << boundary1[i].x << ", " << boundary1[i].y << ", " << boundary1[i].z << ") --- ";
-        std::cout << "(" << boundary2[i].x << ", " << boundary2[i].y << ", " << boundary2[i].z << ")" << std::endl;
+        const std::vector<Pos3D> &part = *parts[k];
+        if (part.size() < 2)
+            continue;
+        wireLines->InsertNextCell(part.size());
+        for (unsigned i = 0; i < part.size(); i++)
+            wireLines->InsertCellPoint(wirePoints->InsertNextPoint(
+                part[i].x * spacing[0], part[i].y * spacing[1], top));
     }
-  
-    for (unsigned i = 0; i < boundary1.size(); i++)
-        dijkstra2D ( data, boundary1[i].x, boundary1[i].y
-                   , boundary2[i].x, boundary2[i].y, boundary1[i].z);
-   
-}
\ No newline at end of file
+    wirePoints->Modified();
+    wireLines->Modified();
+    wirePath->Modified();
+}
+
+
+// The carved voxels on the slice of each view, as points just in front
+// of the slice like the wire.
+void PBrainExtractor::updateOverlays()
+{
+    vtkImageData *data = reader->GetOutput();
+    double *spacing = data->GetSpacing();
+    vtkImageViewer2 *viewers[3] = { sagittalViewer, coronalViewer, transViewer };
+    int slices[3] = { sagittalSlice, coronalSlice, transSlice };
+    std::vector<Pos3D> voxels;
+    
+    for (int axis = 0; axis < 3; axis++)
+    {
+        vtkCamera *camera = viewers[axis]->GetRenderer()->GetActiveCamera();
+        double top = (camera->GetFocalPoint()[axis] + camera->GetPosition()[axis]) / 2;
+        
+        carvingPoints[axis]->Reset();
+        carvingVerts[axis]->Reset();
+        carving.slice(axis, slices[axis], voxels);
+        for (unsigned i = 0; i < voxels.size(); i++)
+        {
+            double p[3] = { voxels[i].x * spacing[0], voxels[i].y * spacing[1],
+                voxels[i].z * spacing[2] };
+            p[axis] = top;
+            carvingVerts[axis]->InsertNextCell(1);
+            carvingVerts[axis]->InsertCellPoint(carvingPoints[axis]->InsertNextPoint(p));
+        }
+        carvingPoints[axis]->Modified();
+        carvingVerts[axis]->Modified();
+        carvingData[axis]->Modified();
+    }
+}
@@ -10,6 +10,12 @@
 #define PBRAINEXTRACTOR_H
 
 #include "PVolumeSegmenter.h"
+#include "PCarvingAlgorithm.h"
+#include "PSurfaceCarver.h"
+
+#include "vtkPoints.h"
+#include "vtkCellArray.h"
+#include "vtkPolyData.h"
 
 
 class PBrainExtractor: public PVolumeSegmenter
@@ -22,6 +28,7 @@ public:
        
 protected slots:
     void showBrainExtractionDialog();
+    void setLiveWire(bool on);
 
 protected:
     void addWidgets();
@@ -30,14 +37,38 @@ protected:
     void addToolBars();
     
     QAction *extractBrainAction;
+    QAction *liveWireAction;
     
     QMenu *brainMenu;
     
     QToolBar *brainToolBar;
     
+    // Live wire on the transverse view
+    LiveWire *liveWire;
+    std::vector<Pos3D> wireFixed;  // Segments fixed by earlier clicks
+    vtkPoints *wirePoints;
+    vtkCellArray *wireLines;
+    vtkPolyData *wirePath;
+    vtkPolyDataMapper *wireMapper;
+    vtkActor *wireActor;
+    
+    // Carving results, drawn over the slice each view shows. The arrays
+    // run over the axes: sagittal (x), coronal (y), transverse (z).
+    CarvingOverlay carving;
+    vtkPoints *carvingPoints[3];
+    vtkCellArray *carvingVerts[3];
+    vtkPolyData *carvingData[3];
+    vtkPolyDataMapper *carvingMapper[3];
+    vtkActor *carvingActor[3];
+    
     // Internal variables
 
     // Supporting functions
+    bool capturesPicks(vtkImageViewer2 *viewer); // Override
+    void pickEvent(vtkImageViewer2 *viewer, unsigned long eventId,
+        double *pos); // Override
+    void drawWire(const std::vector<Pos3D> &live);
+    void updateOverlays(); // Override
 
 };
 
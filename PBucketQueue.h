@@ -0,0 +1,96 @@
+//
+//  PBucketQueue.h
+//
+//  Bounded-integer priority queue (Dial's buckets) for the carving searches.
+//
+
+#ifndef ____PBucketQueue__
+#define ____PBucketQueue__
+
+#include <vector>
+
+
+// A monotone priority queue for integer keys.
+// All edge weights of the carving graphs are bounded shorts, so at any time
+// every key in the queue lies in [current, current + maxWeight]. We keep
+// maxWeight + 1 buckets in a ring and pop from the current one, which gives
+// O(1) amortized push / pop in true distance order.
+//
+// The queue uses lazy deletion: when a node is relaxed again it is simply
+// pushed with the smaller key, and the stale entry is skipped by the caller
+// (see the settled test in the dijkstra loops), so every node is settled
+// exactly once.
+template<typename T>
+class BucketQueue
+{
+public:
+    BucketQueue (unsigned maxWeight)
+    : buckets(maxWeight + 1), ring(maxWeight + 1), current(0), count(0) {}
+
+    bool empty() const { return count == 0; }
+    unsigned size() const { return count; }
+
+    // key must be in [current, current + maxWeight]
+    void push(const T& item, unsigned key)
+    {
+        buckets[key % ring].push_back(item);
+        count++;
+    }
+
+    // the smallest key in the queue, which must not be empty
+    unsigned top()
+    {
+        while (buckets[current % ring].empty())
+            current++;
+        return current;
+    }
+
+    // an empty queue may start over at any key, for searches that resume
+    // from distances already known
+    void rebase(unsigned key)
+    {
+        current = key;
+    }
+
+    // empties the queue for keys from 0 and edges up to maxWeight. the
+    // buckets keep their memory, so a queue reused this way stops allocating
+    // once it has seen its largest search
+    void reset(unsigned maxWeight)
+    {
+        if (count > 0)
+            for (size_t b = 0; b < buckets.size(); b++)
+                buckets[b].clear();
+        if (maxWeight + 1 > buckets.size())
+            buckets.resize(maxWeight + 1);
+        ring = maxWeight + 1;
+        current = 0;
+        count = 0;
+    }
+
+    // pops one of the items with the smallest key, the key is returned in key.
+    // since keys never span more than one ring, all items in the current
+    // bucket share the same key
+    T pop(unsigned& key)
+    {
+        std::vector<T>* b = &buckets[current % ring];
+        while (b->empty())
+        {
+            current++;
+            b = &buckets[current % ring];
+        }
+        T item = b->back();
+        b->pop_back();
+        count--;
+        key = current;
+        return item;
+    }
+
+private:
+    std::vector< std::vector<T> > buckets;
+    unsigned ring;    // buckets in use, the first ring of them
+    unsigned current; // smallest key that can still be in the queue
+    unsigned count;
+};
+
+
+#endif /* defined(____PBucketQueue__) */
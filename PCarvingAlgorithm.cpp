@@ -7,7 +7,17 @@
 //
 
 #include "PCarvingAlgorithm.h"
-#include <set>
+#include "PBucketQueue.h"
+#include "PCarvingGrid.h"
+#include "PCarvingWorkspace.h"
+#include "PEnergyVolume.h"
+#include <QTime>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <map>
 #include <vector>
 
 std::ostream& operator<<(std::ostream& os, const Pos3D& obj)
@@ -16,688 +26,2812 @@ std::ostream& operator<<(std::ostream& os, const Pos3D& obj)
     return os;
 }
 
-// input: voxcel location in index
-void dijkstra2D ( vtkImageData *data, int _x1, int _y1, int _x2, int _y2, int _z )
+// an energy worked out in int, clamped to the range of the short energy grids
+static inline short clampEnergy ( int e )
 {
-    int dims [3];
-    data->GetDimensions(dims);
-    const int nComp = data->GetNumberOfScalarComponents();
-    std::cout << "Dimensions: " << dims[0] << ", " << dims[1] << ", " << dims[2] << std::endl;
-    
-    // std::cout << "Components: " << nComp << std::endl;
-    // std::cout << "Scalar Type: " << data->GetScalarTypeAsString() << std::endl;
-    
-    short* vxl = static_cast<short*>(data->GetScalarPointer());
-    
-    double spacing[3];
-    data->GetSpacing(spacing);
-    
-    std::cout << "Spacing: " << spacing[0] << ", " << spacing[1] << ", " << spacing[2] << std::endl;
-    
-    int x1 = static_cast<int> (_x1 / spacing[0]);
-    int y1 = static_cast<int> (_y1 / spacing[1]);
-    int z = static_cast<int> (_z / spacing[2]);
-    int x2 = static_cast<int> (_x2 / spacing[0]);
-    int y2 = static_cast<int> (_y2 / spacing[1]);
-    
-    int idx1 = z * (dims[0]*dims[1]) + y1 * dims[0] + x1;
-    // std::cout << "(" << x1 << ", " << y1 << ", " << z << ") = " << vxl[idx1] << std::endl;
+    return static_cast<short>(std::max(SHRT_MIN, std::min(e, SHRT_MAX)));
+}
+
+// the 4 moves of search2D: a node reached by move c has its predecessor at
+// (x + move2Dx[c], y + move2Dy[c])
+static const int move2Dx[4] = { 0, 1, -1, 0 };
+static const int move2Dy[4] = { -1, 0, 0, 1 };
+
+// search2D without a target: run until every node is settled
+static const unsigned AllNodes = UINT_MAX;
+
+// what a search2D may do besides its targets: open(n) tells whether the
+// pixel at index n may be entered, settle(n) hears of every node as it is
+// settled and ends the search by returning false. the whole grid, to the
+// targets
+struct WholeGrid2D
+{
+    bool open (unsigned) const { return true; }
+    bool settle (unsigned) { return true; }
+};
+
+// shortest path over the 4-connected grid of a rectangle, starting from the
+// node at index source. moving into a pixel costs the energy of that pixel,
+// maxE bounds the energy. the search stops as soon as every node of the
+// targets [first, last), sorted by index, is settled, only the nodes settled
+// by then have their final distance and move. no targets settles every node.
+// bounds narrows the pixels and may stop it earlier, see WholeGrid2D
+template<typename Bounds>
+static void search2D ( const Grid<short>& energy, short maxE, CarvingWorkspace& nodes, unsigned source
+                     , const unsigned* first, const unsigned* last, Bounds& bounds, CarvingStats* stats = NULL )
+{
+    int width = energy.width;
+    int height = energy.height;
     
-    int idx2 = z * (dims[0]*dims[1]) + y2 * dims[0] + x2;
-    // std::cout << "(" << x2 << ", " << y2 << ", " << z << ") = " << vxl[idx2] << std::endl;
+    nodes.begin(width, energy.size());
+    nodes.reach(source, 0, SearchGrid::NoMove);
     
-    // the small rectangular region bounded by (x1, y1) and (x2, y2)
-    unsigned width = std::abs(x2 - x1) + 20;
-    unsigned height = std::abs(y2 - y1) + 1;
-    // std::cout << "width = " << width << std::endl;
-    // std::cout << "height = " << height << std::endl;
+    // the queue pops in distance order, so each node is expanded once:
+    // only the entry whose key equals its final distance gets through
+    BucketQueue<unsigned>& queue = nodes.emptyQueue(maxE);
+    queue.push(source, 0);
+    size_t settled = 0;
+    size_t left = last - first;
     
-    // prepare the gradient map
-    std::vector< std::vector<short> > gradient;
-    short maxG = 0;
-    for (unsigned i = 0; i < width; i++)
+    while (!queue.empty())
     {
-        std::vector<short> g(height);
-        for (unsigned j = 0; j < height; j++)
+        unsigned key;
+        unsigned n = queue.pop(key);
+        unsigned d = nodes.distance(n);
+        if (key > d)
+            continue; // stale entry, the node is already settled
+        settled++;
+        if (!bounds.settle(n))
+            break;
+        if (left > 0 && std::binary_search(first, last, n) && --left == 0)
+            break;
+        int x = n % width;
+        int y = n / width;
+        
+        // up, left, right, down
+        for (int c = 0; c < 4; c++)
         {
-            short huL = vxl[z * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i-1];
-            short huR = vxl[z * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i+1];
-            short huU = vxl[z * (dims[0]*dims[1]) + (y1+j+1) * dims[0] + x1 + i];
-            short huD = vxl[z * (dims[0]*dims[1]) + (y1+j-1) * dims[0] + x1 + i];
-            // g[j] = static_cast<short>(sqrt(((huL - huR)/2)*((huL - huR)/2) + ((huU - huD)/2)*((huU - huD)/2)));
-            g[j] = vxl[z * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i];
-            if (g[j] > maxG)
-                maxG = g[j];
+            int nx = x - move2Dx[c];
+            int ny = y - move2Dy[c];
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+                continue;
+            unsigned next = ny * width + nx;
+            if (!bounds.open(next))
+                continue;
+            unsigned nd = d + energy[next];
+            if (nd < nodes.distance(next))
+            {
+                nodes.reach(next, nd, c);
+                queue.push(next, nd);
+            }
         }
-        gradient.push_back(g);https://www.sc.com/en/resources/global-en/img/home/Blog_promo_1130x780.jpg
-    }
-    
+        
+        // the diagonal moves (cost * 2) were tried here and left out,
+        // note that enabling them needs the queue to be sized 2 * maxE
+    };
     
-    // print out the gradient map show the gradient map, for debug use only
-    for (int j = height-1; j >= 0; j--)
+    if (stats)
     {
-        for (unsigned i = 0; i < width; i++ )
-        {
-            gradient[i][j] = maxG - gradient[i][j];
-            // std::cout << std::setw(4) << gradient[i][j];
-        }
-        // std::cout << std::endl;
+        stats->nodes += energy.size();
+        stats->settled += settled;
     }
-    
-    // initialize the nodes of the graph, prepare for the dijkstra algorithm
-    std::vector< std::vector<Node<Pos> > > nodes;
-    for ( unsigned i = 0; i < width; i++ )
+}
+
+static void search2D ( const Grid<short>& energy, short maxE, CarvingWorkspace& nodes, unsigned source
+                     , const unsigned* first, const unsigned* last, CarvingStats* stats = NULL )
+{
+    WholeGrid2D bounds;
+    search2D(energy, maxE, nodes, source, first, last, bounds, stats);
+}
+
+// search2D from (0, 0) up to the node at index target, AllNodes for the whole grid
+static void search2D ( const Grid<short>& energy, short maxE, CarvingWorkspace& nodes
+                     , unsigned target = AllNodes, CarvingStats* stats = NULL )
+{
+    search2D(energy, maxE, nodes, 0, &target, &target + (target != AllNodes ? 1 : 0), stats);
+}
+
+// the seam found by search2D, walked back from target to (0, 0) and given in
+// voxel index of the volume, where (0, 0) of the grid is (x0, y0) on slice z
+static void trace2D ( const CarvingWorkspace& nodes, Pos target, int x0, int y0, int z
+                    , std::vector<Pos3D>& seam )
+{
+    int x = target.x;
+    int y = target.y;
+    seam.push_back(Pos3D(x0 + x, y0 + y, z));
+    while (x != 0 || y != 0)
     {
-        Node<Pos> initNode;
-        initNode.distance = 1000000;
-        initNode.previous.x = -1;
-        initNode.previous.y = -1;
-        std::vector<Node<Pos> > c (height, initNode);
-        nodes.push_back(c);
-    }
-    
-    
-    nodes[0][0].distance = 0;
+        unsigned char c = nodes.move(x, y);
+        x += move2Dx[c];
+        y += move2Dy[c];
+        seam.push_back(Pos3D(x0 + x, y0 + y, z));
+    };
+}
+
+// from (x, y) back along the moves of a search to its source, appended to
+// seam in voxel index
+static void traceRegion2D ( const CarvingWorkspace& nodes, int x, int y, int x0, int y0, int z, std::vector<Pos3D>& seam )
+{
+    seam.push_back(Pos3D(x0 + x, y0 + y, z));
+    unsigned char c;
+    while ((c = nodes.move(x, y)) != SearchGrid::NoMove)
+    {
+        x += move2Dx[c];
+        y += move2Dy[c];
+        seam.push_back(Pos3D(x0 + x, y0 + y, z));
+    };
+}
+
+// dijkstra from both end points at once, on any of the carving graphs.
+// Graph gives, for a node, its successors and predecessors with the cost of
+// each edge and a move code, and turns a stored code back into the parent
+// in the forward or the backward tree. the searches take turns by smallest
+// key, and whenever one labels a node the other has labelled, the path
+// through it is a candidate. once the two smallest keys add up to the best
+// candidate no shorter path can be found, so the cost is that of the one
+// way search. path is given from target back to source, empty if the
+// target cannot be reached
+template<typename Graph>
+static void bidirectionalSearch ( const Graph& graph, unsigned source, unsigned target, unsigned maxW
+                                , std::vector<unsigned>& path, CarvingStats* stats )
+{
+    const unsigned INF = UINT_MAX;
+    SearchGrid nodes[2]; // forward from source, backward from target
+    for (int side = 0; side < 2; side++)
+        graph.assign(nodes[side]);
+    nodes[0].distance[source] = 0;
+    nodes[1].distance[target] = 0;
     
-    std::set<Pos> queue;
-    Pos start(0, 0);
+    BucketQueue<unsigned> queue0(maxW), queue1(maxW);
+    BucketQueue<unsigned>* queue[2] = { &queue0, &queue1 };
+    queue0.push(source, 0);
+    queue1.push(target, 0);
     
-    queue.insert(start);
+    unsigned best = source == target ? 0 : INF;
+    unsigned meet = source;
+    size_t settled = 0;
+    std::vector<unsigned> next(graph.maxDegree());
+    std::vector<unsigned> weight(graph.maxDegree());
+    std::vector<unsigned char> code(graph.maxDegree());
     
-    while (!queue.empty())
+    while (!queue0.empty() && !queue1.empty())
     {
-        Pos pos = *queue.begin();
-        queue.erase(queue.begin());
-        double d = nodes[pos.x][pos.y].distance;
+        unsigned top0 = queue0.top();
+        unsigned top1 = queue1.top();
+        if (best != INF && top0 + top1 >= best)
+            break;
+        int side = top0 <= top1 ? 0 : 1;
+        Grid<unsigned>& distance = nodes[side].distance;
+        const Grid<unsigned>& other = nodes[1-side].distance;
         
-        // up
-        if ( pos.y + 1 < height &&
-            nodes[pos.x][pos.y+1].distance > d + gradient[pos.x][pos.y+1])
-        {
-            Pos nextPos;
-            nextPos.x = pos.x;
-            nextPos.y = pos.y+1;
-            nodes[nextPos.x][nextPos.y].distance = d+gradient[pos.x][pos.y+1];
-            nodes[nextPos.x][nextPos.y].previous = pos;
-            queue.insert(nextPos);
-        }
-        /*
-         // up left
-         if ( pos.y + 1 < height && pos.x > 0 &&
-         nodes[pos.x-1][pos.y+1].distance > d + gradient[pos.x-1][pos.y+1] * 2)
-         {
-         Pos nextPos;
-         nextPos.x = pos.x-1;
-         nextPos.y = pos.y+1;
-         nodes[nextPos.x][nextPos.y].distance = d+gradient[pos.x-1][pos.y+1] * 2;
-         nodes[nextPos.x][nextPos.y].previous = pos;
-         queue.insert(nextPos);
-         }
-         
-         // up right
-         if ( pos.y + 1 < height && pos.x + 1 < width &&
-         nodes[pos.x+1][pos.y+1].distance > d + gradient[pos.x+1][pos.y+1] * 2)
-         {
-         Pos nextPos;
-         nextPos.x = pos.x+1;
-         nextPos.y = pos.y+1;
-         nodes[nextPos.x][nextPos.y].distance = d+gradient[pos.x+1][pos.y+1] * 2;
-         nodes[nextPos.x][nextPos.y].previous = pos;
-         queue.insert(nextPos);
-         }
-         */
-        // left
-        if ( pos.x > 0 &&
-            nodes[pos.x-1][pos.y].distance > d + gradient[pos.x-1][pos.y])
-        {
-            Pos nextPos;
-            nextPos.x = pos.x-1;
-            nextPos.y = pos.y;
-            nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x-1][pos.y];
-            nodes[nextPos.x][nextPos.y].previous = pos;
-            queue.insert(nextPos);
-        }
+        unsigned key;
+        unsigned n = queue[side]->pop(key);
+        unsigned d = distance[n];
+        if (key > d)
+            continue; // stale entry, the node is already settled
+        settled++;
         
-        // right
-        if ( pos.x + 1 < width &&
-            nodes[pos.x+1][pos.y].distance > d + gradient[pos.x+1][pos.y])
+        int degree = side == 0 ? graph.successors(n, &next[0], &weight[0], &code[0])
+                               : graph.predecessors(n, &next[0], &weight[0], &code[0]);
+        for (int m = 0; m < degree; m++)
         {
-            Pos nextPos;
-            nextPos.x = pos.x+1;
-            nextPos.y = pos.y;
-            nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x+1][pos.y];
-            nodes[nextPos.x][nextPos.y].previous = pos;
-            queue.insert(nextPos);
+            unsigned v = next[m];
+            unsigned nd = d + weight[m];
+            if (nd < distance[v])
+            {
+                distance[v] = nd;
+                nodes[side].move[v] = code[m];
+                queue[side]->push(v, nd);
+                if (other[v] != INF && nd + other[v] < best)
+                {
+                    best = nd + other[v];
+                    meet = v;
+                }
+            }
         }
-        
-        // down
-        if ( pos.y > 0 &&
-            nodes[pos.x][pos.y-1].distance > d + gradient[pos.x][pos.y-1])
-        {
-            Pos nextPos;
-            nextPos.x = pos.x;
-            nextPos.y = pos.y-1;
-            nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x][pos.y-1];
-            nodes[nextPos.x][nextPos.y].previous = pos;
-            queue.insert(nextPos);
-        }
-        /*
-         // down left
-         if ( pos.y > 0 && pos.x > 0 &&
-         nodes[pos.x-1][pos.y-1].distance > d + gradient[pos.x-1][pos.y-1] * 2)
-         {
-         Pos nextPos;
-         nextPos.x = pos.x-1;
-         nextPos.y = pos.y-1;
-         nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x-1][pos.y-1] * 2;
-         nodes[nextPos.x][nextPos.y].previous = pos;
-         queue.insert(nextPos);
-         }
-         
-         // down right
-         if ( pos.y > 0 && pos.x + 1 < width &&
-         nodes[pos.x+1][pos.y-1].distance > d + gradient[pos.x+1][pos.y-1] * 2)
-         {
-         Pos nextPos;
-         nextPos.x = pos.x+1;
-         nextPos.y = pos.y-1;
-         nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x+1][pos.y-1] * 2;
-         nodes[nextPos.x][nextPos.y].previous = pos;
-         queue.insert(nextPos);
-         }
-         */
     };
     
-    /*
-    std::cout << "========distance map============" << std::endl;
-    // show the distance map
-    for (int j = height-1; j >= 0; j--)
+    if (stats)
     {
-        for (unsigned i = 0; i < width; i++ )
-            std::cout << std::setw(4) << nodes[i][j].distance;
-        std::cout << std::endl;
-    }
-    std::cout << "========path====================" << std::endl;
-    */
-  
-    // show the path
-    std::vector< std::vector<int> > path;
-    for ( unsigned i = 0; i < width; i++ )
-    {
-        std::vector<int> p (height, 0);
-        path.push_back(p);
+        stats->nodes += nodes[0].distance.size();
+        stats->settled += settled;
     }
     
-    Node<Pos> backward = nodes[width-1-20][height-1];
-    path[width-1-20][height-1] = 1;
-    while (!(backward.previous == start))
-    {
-        path[backward.previous.x][backward.previous.y] = 1;
-        backward = nodes[backward.previous.x][backward.previous.y];
-        std::cout << gradient[backward.previous.x][backward.previous.y] << std::endl;
-    };
-    path[start.x][start.y] = 1;
+    path.clear();
+    if (best == INF)
+        return;
     
-    for (int j = height-1; j >= 0; j--)
+    // meet back to source, reversed, then on from meet to target
+    for (unsigned n = meet; n != source; n = graph.forwardParent(n, nodes[0].move[n]))
+        path.push_back(n);
+    path.push_back(source);
+    std::reverse(path.begin(), path.end());
+    for (unsigned n = meet; n != target; )
     {
-        for (unsigned i = 0; i < width; i++ ) {
-        //  std::cout << std::setw(4) << path[i][j];
-            if (path[i][j] == 1)
-            {
-                // draw the seam
-                vxl[(z+1) * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i] = 1000;
-                vxl[z * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i] = 1000;
-            }
-        }
-        std::cout << std::endl;
+        n = graph.backwardParent(n, nodes[1].move[n]);
+        path.push_back(n);
     }
+    std::reverse(path.begin(), path.end());
 }
 
-// input: voxcel location in index
-void dijkstra2DEx ( vtkImageData *data, int _x1, int _y1, int _x2, int _y2, int _z )
+// the graph of search2D: moving into a pixel costs its energy. both trees
+// code a node by the move c that leads to its parent at n + move2D[c]
+struct Graph2D
 {
-    int dims [3]; // dimension of the image data
-    data->GetDimensions(dims);
-    const int nComp = data->GetNumberOfScalarComponents(); // number of components
-    // std::cout << "Scalar Type: " << data->GetScalarTypeAsString() << std::endl;
-    short* vxl = static_cast<short*>(data->GetScalarPointer());
-    
-    double spacing[3];
-    data->GetSpacing(spacing);
-    int x1 = static_cast<int> (_x1 / spacing[0]);
-    int y1 = static_cast<int> (_y1 / spacing[1]);
-    int z = static_cast<int> (_z / spacing[2]);
-    int x2 = static_cast<int> (_x2 / spacing[0]);
-    int y2 = static_cast<int> (_y2 / spacing[1]);
+    const Grid<short>& energy;
+    int width;
+    int height;
+    Graph2D (const Grid<short>& _energy) : energy(_energy), width(_energy.width), height(_energy.height) {}
     
-    int idx1 = z * (dims[0]*dims[1]) + y1 * dims[0] + x1;
-    int idx2 = z * (dims[0]*dims[1]) + y2 * dims[0] + x2;
-
-    // the small rectangular region bounded by (x1, y1) and (x2, y2)
-    unsigned width = std::abs(x2 - x1) + 1;
-    unsigned height = std::abs(y2 - y1) + 1;
-
+    void assign (SearchGrid& nodes) const { nodes.assign(width, height); }
+    int maxDegree () const { return 4; }
     
-    // prepare the gradient map
-    std::vector< std::vector<short> > gradient;
-    short maxG = 0;
-    for (unsigned i = 0; i < width; i++)
+    int neighbours (unsigned n, unsigned* next, unsigned char* code) const
     {
-        std::vector<short> g(height);
-        for (unsigned j = 0; j < height; j++)
+        int x = n % width;
+        int y = n / width;
+        int degree = 0;
+        for (int c = 0; c < 4; c++)
         {
-            short huL = vxl[z * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i-1];
-            short huR = vxl[z * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i+1];
-            short huU = vxl[z * (dims[0]*dims[1]) + (y1+j+1) * dims[0] + x1 + i];
-            short huD = vxl[z * (dims[0]*dims[1]) + (y1+j-1) * dims[0] + x1 + i];
-            g[j] = static_cast<short>(sqrt(((huL - huR)/2)*((huL - huR)/2) + ((huU - huD)/2)*((huU - huD)/2)));
-            if (g[j] > maxG)
-                maxG = g[j];
+            int nx = x - move2Dx[c];
+            int ny = y - move2Dy[c];
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+                continue;
+            next[degree] = ny * width + nx;
+            code[degree] = c;
+            degree++;
         }
-        gradient.push_back(g);
+        return degree;
     }
-    // we prefer high gradient
-    for (int j = height-1; j >= 0; j--)
-        for (unsigned i = 0; i < width; i++ )
-            gradient[i][j] = maxG - gradient[i][j];
-
-    // initialize the nodes of the graph, prepare for the dijkstra algorithm
-    std::vector< std::vector<Node<Pos> > > nodes;
-    for ( unsigned i = 0; i < width; i++ )
+    int successors (unsigned n, unsigned* next, unsigned* weight, unsigned char* code) const
     {
-        Node<Pos> initNode;
-        initNode.distance = 1000000;
-        initNode.previous.x = -1;
-        initNode.previous.y = -1;
-        std::vector<Node<Pos> > c (height, initNode);
-        nodes.push_back(c);
+        int degree = neighbours(n, next, code);
+        for (int m = 0; m < degree; m++)
+            weight[m] = energy[next[m]];
+        return degree;
     }
+    int predecessors (unsigned n, unsigned* prev, unsigned* weight, unsigned char* code) const
+    {
+        int degree = neighbours(n, prev, code);
+        for (int m = 0; m < degree; m++)
+            weight[m] = energy[n];
+        return degree;
+    }
+    unsigned forwardParent (unsigned n, unsigned char c) const
+    {
+        return n + move2Dy[c] * width + move2Dx[c];
+    }
+    unsigned backwardParent (unsigned n, unsigned char c) const
+    {
+        return forwardParent(n, c);
+    }
+    // the code of the same edge seen from its other end
+    unsigned char reverseMove (unsigned char c) const
+    {
+        return 3 - c;
+    }
+};
+
+// dijkstra on the keys g + h, where h is a lower bound on the cost left from a
+// node to the target. h must be consistent, dropping along an edge by no more
+// than the edge costs, so that nodes still settle once, in order of g + h,
+// and the path found is a shortest one. the keys are kept relative to
+// h(source) so the bucket queue starts at 0, and as h rises along an edge by
+// at most maxW a key is never more than 2 maxW above the current one.
+// path is given from target back to source, empty if it cannot be reached
+template<typename Graph, typename Heuristic>
+static void astarSearch ( const Graph& graph, const Heuristic& h, unsigned source, unsigned target
+                        , unsigned maxW, std::vector<unsigned>& path, CarvingStats* stats )
+{
+    SearchGrid nodes;
+    graph.assign(nodes);
+    Grid<unsigned>& distance = nodes.distance;
+    distance[source] = 0;
     
-    
-    nodes[0][0].distance = 0;
-    
-    std::set<Pos> queue;
-    Pos start(0, 0);
-    
-    queue.insert(start);
+    unsigned h0 = h(source);
+    BucketQueue<unsigned> queue(2*maxW);
+    queue.push(source, 0);
+    size_t settled = 0;
+    std::vector<unsigned> next(graph.maxDegree());
+    std::vector<unsigned> weight(graph.maxDegree());
+    std::vector<unsigned char> code(graph.maxDegree());
     
     while (!queue.empty())
     {
-        Pos pos = *queue.begin();
-        queue.erase(queue.begin());
-        double d = nodes[pos.x][pos.y].distance;
+        unsigned key;
+        unsigned n = queue.pop(key);
+        unsigned d = distance[n];
+        if (key > d + h(n) - h0)
+            continue; // stale entry, the node is already settled
+        settled++;
+        if (n == target)
+            break;
         
-        // up
-        if ( pos.y + 1 < height &&
-            nodes[pos.x][pos.y+1].distance > d + gradient[pos.x][pos.y+1])
-        {
-            Pos nextPos;
-            nextPos.x = pos.x;
-            nextPos.y = pos.y+1;
-            nodes[nextPos.x][nextPos.y].distance = d+gradient[pos.x][pos.y+1];
-            nodes[nextPos.x][nextPos.y].previous = pos;
-            queue.insert(nextPos);
-        }
-        /*
-         // up left
-         if ( pos.y + 1 < height && pos.x > 0 &&
-         nodes[pos.x-1][pos.y+1].distance > d + gradient[pos.x-1][pos.y+1] * 2)
-         {
-         Pos nextPos;
-         nextPos.x = pos.x-1;
-         nextPos.y = pos.y+1;
-         nodes[nextPos.x][nextPos.y].distance = d+gradient[pos.x-1][pos.y+1] * 2;
-         nodes[nextPos.x][nextPos.y].previous = pos;
-         queue.insert(nextPos);
-         }
-         
-         // up right
-         if ( pos.y + 1 < height && pos.x + 1 < width &&
-         nodes[pos.x+1][pos.y+1].distance > d + gradient[pos.x+1][pos.y+1] * 2)
-         {
-         Pos nextPos;
-         nextPos.x = pos.x+1;
-         nextPos.y = pos.y+1;
-         nodes[nextPos.x][nextPos.y].distance = d+gradient[pos.x+1][pos.y+1] * 2;
-         nodes[nextPos.x][nextPos.y].previous = pos;
-         queue.insert(nextPos);
-         }
-         */
-        // left
-        if ( pos.x > 0 &&
-            nodes[pos.x-1][pos.y].distance > d + gradient[pos.x-1][pos.y])
-        {
-            Pos nextPos;
-            nextPos.x = pos.x-1;
-            nextPos.y = pos.y;
-            nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x-1][pos.y];
-            nodes[nextPos.x][nextPos.y].previous = pos;
-            queue.insert(nextPos);
-        }
-        
-        // right
-        if ( pos.x + 1 < width &&
-            nodes[pos.x+1][pos.y].distance > d + gradient[pos.x+1][pos.y])
+        int degree = graph.successors(n, &next[0], &weight[0], &code[0]);
+        for (int m = 0; m < degree; m++)
         {
-            Pos nextPos;
-            nextPos.x = pos.x+1;
-            nextPos.y = pos.y;
-            nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x+1][pos.y];
-            nodes[nextPos.x][nextPos.y].previous = pos;
-            queue.insert(nextPos);
+            unsigned v = next[m];
+            unsigned nd = d + weight[m];
+            if (nd < distance[v])
+            {
+                distance[v] = nd;
+                nodes.move[v] = code[m];
+                queue.push(v, nd + h(v) - h0);
+            }
         }
-        
-        // down
-        if ( pos.y > 0 &&
-            nodes[pos.x][pos.y-1].distance > d + gradient[pos.x][pos.y-1])
-        {
-            Pos nextPos;
-            nextPos.x = pos.x;
-            nextPos.y = pos.y-1;
-            nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x][pos.y-1];
-            nodes[nextPos.x][nextPos.y].previous = pos;
-            queue.insert(nextPos);
-        }
-        /*
-         // down left
-         if ( pos.y > 0 && pos.x > 0 &&
-         nodes[pos.x-1][pos.y-1].distance > d + gradient[pos.x-1][pos.y-1] * 2)
-         {
-         Pos nextPos;
-         nextPos.x = pos.x-1;
-         nextPos.y = pos.y-1;
-         nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x-1][pos.y-1] * 2;
-         nodes[nextPos.x][nextPos.y].previous = pos;
-         queue.insert(nextPos);
-         }
-         
-         // down right
-         if ( pos.y > 0 && pos.x + 1 < width &&
-         nodes[pos.x+1][pos.y-1].distance > d + gradient[pos.x+1][pos.y-1] * 2)
-         {
-         Pos nextPos;
-         nextPos.x = pos.x+1;
-         nextPos.y = pos.y-1;
-         nodes[nextPos.x][nextPos.y].distance = d + gradient[pos.x+1][pos.y-1] * 2;
-         nodes[nextPos.x][nextPos.y].previous = pos;
-         queue.insert(nextPos);
-         }
-         */
     };
     
-    
-    /*    std::cout << "========distance map============" << std::endl;
-     // show the distance map
-     for (int j = height-1; j >= 0; j--)
-     {
-     for (unsigned i = 0; i < width; i++ )
-     std::cout << std::setw(4) << nodes[i][j].distance;
-     std::cout << std::endl;
-     }
-     std::cout << "========path====================" << std::endl;
-     */
-    // show the path
-    std::vector< std::vector<int> > path;
-    for ( unsigned i = 0; i < width; i++ )
+    if (stats)
     {
-        std::vector<int> p (height, 0);
-        path.push_back(p);
+        stats->nodes += distance.size();
+        stats->settled += settled;
     }
     
-    Node<Pos> backward = nodes[width-1][height-1];
-    path[width-1][height-1] = 1;
-    while (!(backward.previous == start))
-    {
-        path[backward.previous.x][backward.previous.y] = 1;
-        backward = nodes[backward.previous.x][backward.previous.y];
-    };
-    path[start.x][start.y] = 1;
-    
-    for (int j = height-1; j >= 0; j--)
+    path.clear();
+    if (distance[target] == UINT_MAX)
+        return;
+    for (unsigned n = target; n != source; n = graph.forwardParent(n, nodes.move[n]))
+        path.push_back(n);
+    path.push_back(source);
+}
+
+// the A* bound of the 2D graphs. a path on to the target enters every row
+// between the node and the target row, the latter included, and every such
+// column as well, so it pays at least the smallest energy of each of them.
+// the bound is the larger of the two sums. both sums drop by no more than the
+// energy of the pixel entered, so the bound is consistent. (the minimum of
+// the whole box times the distance would be 0 here, the energies are made
+// to reach 0)
+struct Heuristic2D
+{
+    std::vector<unsigned> rows; // rows[y] = sum of the row minima below row y
+    std::vector<unsigned> cols; // cols[x] = sum of the column minima left of column x
+    int width;
+    int tx;
+    int ty;
+    Heuristic2D (const Grid<short>& energy, unsigned target)
+    : rows(energy.height + 1, 0), cols(energy.width + 1, 0), width(energy.width)
+    , tx(target % energy.width), ty(target / energy.width)
     {
-        for (unsigned i = 0; i < width; i++ ) {
-            //  std::cout << std::setw(4) << path[i][j];
-            if (path[i][j] == 1)
+        std::vector<unsigned> rowMin(energy.height, SHRT_MAX);
+        std::vector<unsigned> colMin(energy.width, SHRT_MAX);
+        for (unsigned y = 0; y < energy.height; y++)
+            for (unsigned x = 0; x < energy.width; x++)
             {
-                // draw the seam
-                vxl[(z+1) * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i] = 1000;
-                vxl[z * (dims[0]*dims[1]) + (y1+j) * dims[0] + x1 + i] = 1000;
+                unsigned e = energy(x, y);
+                rowMin[y] = std::min(rowMin[y], e);
+                colMin[x] = std::min(colMin[x], e);
             }
+        for (unsigned y = 0; y < energy.height; y++)
+            rows[y+1] = rows[y] + rowMin[y];
+        for (unsigned x = 0; x < energy.width; x++)
+            cols[x+1] = cols[x] + colMin[x];
+    }
+    // the minima of the lines strictly between a and the target line t, and of t
+    static unsigned between (const std::vector<unsigned>& sum, int a, int t)
+    {
+        if (a < t)
+            return sum[t+1] - sum[a+1];
+        return sum[a] - sum[t];
+    }
+    unsigned operator() (unsigned n) const
+    {
+        return std::max(between(rows, n / width, ty), between(cols, n % width, tx));
+    }
+};
+
+unsigned CarvingOverlay::add ( const std::vector<Pos3D>& path )
+{
+    paths.push_back(path);
+    unsigned l = paths.size();
+    for (unsigned n = 0; n < path.size(); n++)
+    {
+        const Pos3D& p = path[n];
+        unsigned& label = labels[p];
+        if (label == 0)
+        {
+            slices[0][p.x].push_back(p);
+            slices[1][p.y].push_back(p);
+            slices[2][p.z].push_back(p);
         }
-        std::cout << std::endl;
+        label = l;
     }
+    return l;
 }
 
+void CarvingOverlay::clear ()
+{
+    paths.clear();
+    labels.clear();
+    for (int axis = 0; axis < 3; axis++)
+        slices[axis].clear();
+}
 
-void dijkstra3D ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2 )
+unsigned CarvingOverlay::label ( const Pos3D& voxel ) const
 {
+    std::map<Pos3D, unsigned>::const_iterator it = labels.find(voxel);
+    return it == labels.end() ? 0 : it->second;
+}
 
-    int dims [3];
-    data->GetDimensions(dims);
-    short* vxl = static_cast<short*>(data->GetScalarPointer());
+void CarvingOverlay::slice ( int axis, int index, std::vector<Pos3D>& voxels ) const
+{
+    voxels.clear();
+    if (axis < 0 || axis > 2)
+        return;
+    std::map< int, std::vector<Pos3D> >::const_iterator it = slices[axis].find(index);
+    if (it != slices[axis].end())
+        voxels = it->second;
+}
+
+// an empty seam, from an end point that cannot be reached, adds nothing
+static void drawSeam ( CarvingOverlay& overlay, const std::vector<Pos3D>& seam )
+{
+    if (!seam.empty())
+        overlay.add(seam);
+}
+
+// the energy of dijkstra2D over the window of slice z from (x1, y1), width x
+// height pixels. returns the largest edge weight, which bounds the bucket queue
+static short windowEnergy2D ( const EnergyView& intensity, int x1, int y1, int z
+                            , unsigned width, unsigned height, Grid<short>& gradient )
+{
+    // prepare the gradient map
+    gradient.resize(width, height);
+    short maxG = 0;
+    for (unsigned j = 0; j < height; j++)
+    {
+        const short* row = intensity.row(y1+j, z) + x1;
+        for (unsigned i = 0; i < width; i++)
+        {
+            // g = sqrt(((huL - huR)/2)^2 + ((huU - huD)/2)^2) was tried here,
+            // the intensity itself works better for now
+            gradient(i, j) = row[i];
+            if (gradient(i, j) > maxG)
+                maxG = gradient(i, j);
+        }
+    }
     
+    short maxE = 0;
+    for (size_t n = 0; n < gradient.size(); n++)
+    {
+        gradient[n] = clampEnergy(maxG - gradient[n]);
+        if (gradient[n] > maxE)
+            maxE = gradient[n];
+    }
+    return maxE;
+}
+
+// the search of dijkstra2D on the intensity feature of the volume. it only
+// reads the feature, so several of them can run at the same time
+static void carve2D ( vtkImageData *data, const EnergyView& intensity
+                    , int _x1, int _y1, int _x2, int _y2, int _z, std::vector<Pos3D>& seam
+                    , CarvingSolver solver, CarvingStats* stats )
+{
     double spacing[3];
     data->GetSpacing(spacing);
+    
     int x1 = static_cast<int> (_x1 / spacing[0]);
     int y1 = static_cast<int> (_y1 / spacing[1]);
-    int z1 = static_cast<int> (_z1 / spacing[2]);
+    int z = static_cast<int> (_z / spacing[2]);
     int x2 = static_cast<int> (_x2 / spacing[0]);
     int y2 = static_cast<int> (_y2 / spacing[1]);
-    int z2 = static_cast<int> (_z2 / spacing[2]);
-    
-    
-    int stepZ = z1 < z2 ? 1 : -1;
-    int stepX = x1 < x2 ? 1 : -1;
-    int stepY = y1 < y2 ? 1 : -1;
-    
-    // the small cube bounded by (x1, y1, z1) and (x2, y2, z2)
-    unsigned width = std::abs(x2 - x1) + 1;
-    unsigned height = std::abs(y2 - y1) + 1;
-    unsigned depth = std::abs(z2 - z1) + 1;
     
-    // instead of using the gradient map in 2D,
-    // let's try the intensity map here
-    std::vector< std::vector< std::vector<short> > > energy;
-    // the nodes construct a 3D graph now
-    std::vector< std::vector< std::vector<Node<Pos3D> > > > nodes;
-    for ( unsigned i = 0; i < width; i++ )
+    if (x1 < 0 || x1 >= intensity.width() || y1 < 0 || y1 >= intensity.height()
+        || x2 < 0 || x2 >= intensity.width() || y2 < 0 || y2 >= intensity.height()
+        || z < 0 || z >= intensity.depth())
     {
-        std::vector< std::vector<Node<Pos3D> > > nodesInternal;
-        std::vector< std::vector<short> > energyInternal;
-        for (unsigned j = 0; j < height; j++)
-        {
-            Node<Pos3D> initNode;
-            initNode.distance = 1000000;
-            initNode.previous.x = -1;
-            initNode.previous.y = -1;
-            initNode.previous.z = -1;
-            std::vector<Node<Pos3D> > c (depth, initNode);
-            nodesInternal.push_back(c);
-            
-            std::vector<short> e(depth);
-            for (unsigned k = 0; k < depth; k++)
-                e[k] = 1000 - vxl[(z1+k*stepZ)*dims[0]*dims[1] + (y1+j*stepY)*dims[0] + (x1+i)*stepX];
-            energyInternal.push_back(e);
-        }
-        nodes.push_back(nodesInternal);
-        energy.push_back(energyInternal);
+        std::cout << "dijkstra2D: end point off the slice" << std::endl;
+        return;
     }
     
-    nodes[0][0][0].distance = 0;
-    std::set<Pos3D> queue;
-    Pos3D start(0, 0, 0);
+    // the small rectangular region bounded by (x1, y1) and (x2, y2), with 20
+    // more columns on its right within the slice. it is never empty, also
+    // when the end points share a column or a row
+    int x0 = std::min(x1, x2);
+    int y0 = std::min(y1, y2);
+    unsigned width = std::min(std::max(x1, x2) + 20, intensity.width() - 1) - x0 + 1;
+    unsigned height = std::abs(y2 - y1) + 1;
     
+    CarvingWorkspace& work = CarvingWorkspace::local();
+    Grid<short>& gradient = work.energy;
+    short maxE = windowEnergy2D(intensity, x0, y0, z, width, height, gradient);
     
-    queue.insert(start);
-    // in the 3D search, we impose the constrain that the graph is one directional along z axis
-    // meaning that the edges are directed only along z1 -> z2
-    // also, we want one voxel per z, so no planar edge is added
+    // from (x1, y1) to (x2, y2), the seam is traced back from the latter
+    unsigned source = gradient.index(x1 - x0, y1 - y0);
+    unsigned target = gradient.index(x2 - x0, y2 - y0);
+    if (solver == BidirectionalSolver || solver == AStarSolver)
+    {
+        std::vector<unsigned> path;
+        if (solver == BidirectionalSolver)
+            bidirectionalSearch(Graph2D(gradient), source, target, maxE, path, stats);
+        else
+            astarSearch(Graph2D(gradient), Heuristic2D(gradient, target), source, target, maxE, path, stats);
+        for (unsigned n = 0; n < path.size(); n++)
+            seam.push_back(Pos3D(x0 + path[n] % width, y0 + path[n] / width, z));
+        return;
+    }
     
-    int stepW = 2; // when stepping z, we allow a 5x5 window to be feasible. this can be extended to be flexible based on (x1, y1, z1) and (x2, y2, z2);
-    Pos3D pL (0, 0, 0), pU(width-1, height-1, depth-1); // lower and upper bound
+    search2D(gradient, maxE, work, source, &target, &target + 1, stats);
     
-    while (!queue.empty())
+    traceRegion2D(work, x2 - x0, y2 - y0, x0, y0, z, seam);
+}
+
+// the energy of a window of slice z with its corner at (x0, y0), the intensity
+// feature taken from the maximum over the set pixels of region. returns the
+// largest energy
+static short regionEnergy2D ( const EnergyView& intensity, const Grid<unsigned char>& region, int x0, int y0, int z
+                            , Grid<short>& energy )
+{
+    int width = region.width;
+    int height = region.height;
+    short maxG = SHRT_MIN;
+    for (int j = 0; j < height; j++)
     {
-        Pos3D pos = *queue.begin();
-        queue.erase(queue.begin());
-        double d = nodes[pos.x][pos.y][pos.z].distance;
-        for (int i = -stepW; i <= stepW; i++)
-        {
-            for (int j = -stepW; j <= stepW; j++)
-            {
-                Pos3D nextPos;
-                nextPos.x = pos.x + i;
-                nextPos.y = pos.y + j;
-                nextPos.z = pos.z + 1;
-                
-                if (nextPos <= pU && pL <= nextPos)
-                {
-                    // consider this candidate
-                    double newDistance = d + energy[pos.x][pos.y][pos.z];
-                    if (newDistance < nodes[nextPos.x][nextPos.y][nextPos.z].distance)
-                    {
-                        nodes[nextPos.x][nextPos.y][nextPos.z].distance = newDistance;
-                        nodes[nextPos.x][nextPos.y][nextPos.z].previous = pos;
-                        queue.insert(nextPos);
-                    }
-                }
-            }
-        }
-        
-    };
-    
-    // show the path
-    std::vector< std::vector< std::vector<int> > > path;
-    for ( unsigned i = 0; i < width; i++ )
+        const short* row = intensity.row(y0 + j, z) + x0;
+        for (int i = 0; i < width; i++)
+            if (region(i, j))
+                maxG = std::max(maxG, row[i]);
+    }
+    energy.resize(width, height);
+    short maxE = 0;
+    for (int j = 0; j < height; j++)
     {
-        std::vector< std::vector<int> > pathInternal;
-        for (unsigned j = 0; j < height; j++)
+        const short* row = intensity.row(y0 + j, z) + x0;
+        for (int i = 0; i < width; i++)
         {
-            std::vector<int> p (depth, 0);
-            pathInternal.push_back(p);
+            energy(i, j) = clampEnergy(maxG - row[i]);
+            maxE = std::max(maxE, energy(i, j));
         }
-        path.push_back(pathInternal);
     }
-    
-    Node<Pos3D> backward = nodes[width-1][height-1][depth-1];
-    path[width-1][height-1][depth-1] = 1;
-    
-    while (!(backward.previous == start))
-    {
-        // std::cout << backward.previous << std::endl;
-        path[backward.previous.x][backward.previous.y][backward.previous.z] = 1;
-        backward = nodes[backward.previous.x][backward.previous.y][backward.previous.z];
-    };
-    path[start.x][start.y][start.z] = 1;
+    return maxE;
+}
 
-    for (int j = height-1; j >= 0; j--)
-        for (unsigned i = 0; i < width; i++ )
-            for (unsigned k = 0; k < depth; k++) {
-                if (path[i][j][k] == 1)
-                {
-                    // draw the seam
-                    vxl[(z1 + k*stepZ) * (dims[0]*dims[1]) + (y1+j*stepY) * dims[0] + x1 + i*stepX] = 1000;
-                    vxl[((z1+1) + k*stepZ) * (dims[0]*dims[1]) + (y1+j*stepY) * dims[0] + x1 + i*stepX] = 1000;
-                }
-            }
-    
+// the bounds of a search2D over the set pixels of a region window only
+struct RegionBounds2D
+{
+    const Grid<unsigned char>& region;
+    RegionBounds2D (const Grid<unsigned char>& _region) : region(_region) {}
+    bool open (unsigned n) const { return region[n] != 0; }
+    bool settle (unsigned) { return true; }
+};
+
+// search2D from source over the set pixels of region only, stopping once
+// target is settled. a target of UINT_MAX searches the whole region
+static void searchRegion2D ( const Grid<short>& energy, short maxE, const Grid<unsigned char>& region
+                           , unsigned source, unsigned target, CarvingWorkspace& nodes )
+{
+    RegionBounds2D bounds(region);
+    search2D(energy, maxE, nodes, source, &target, &target + (target != AllNodes ? 1 : 0), bounds);
 }
 
-void averageRank3D ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
-                    , std::vector<Pos3D>& result)
+// whether p lies on a set pixel of the region window
+static bool inRegion2D ( const Grid<unsigned char>& region, int x0, int y0, const Pos3D& p )
 {
+    int x = p.x - x0;
+    int y = p.y - y0;
+    return x >= 0 && x < (int)region.width && y >= 0 && y < (int)region.height && region(x, y);
+}
+
+void carveRegion2D ( const EnergyView& intensity, const Grid<unsigned char>& region, int x0, int y0
+                   , const Pos3D& from, const Pos3D& to, std::vector<Pos3D>& seam )
+{
+    int z = from.z;
+    seam.clear();
+    CarvingWorkspace& work = CarvingWorkspace::local();
+    Grid<short>& energy = work.energy;
+    short maxE = regionEnergy2D(intensity, region, x0, y0, z, energy);
+    if (!inRegion2D(region, x0, y0, from) || !inRegion2D(region, x0, y0, to))
+        return;
     
+    unsigned target = energy.index(to.x - x0, to.y - y0);
+    searchRegion2D(energy, maxE, region, energy.index(from.x - x0, from.y - y0), target, work);
+    if (work.distance(target) == UINT_MAX)
+        return;
+    traceRegion2D(work, to.x - x0, to.y - y0, x0, y0, z, seam);
+}
+
+void drawSurface ( CarvingOverlay& overlay, const std::vector< std::vector<Pos3D> >& curves )
+{
+    for (unsigned n = 0; n < curves.size(); n++)
+        drawSeam(overlay, curves[n]);
+}
+
+// input: voxcel location in index
+void dijkstra2D ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _x2, int _y2, int _z
+                , CarvingSolver solver, CarvingStats* stats )
+{
     int dims [3];
     data->GetDimensions(dims);
-    short* vxl = static_cast<short*>(data->GetScalarPointer());
+    const int nComp = data->GetNumberOfScalarComponents();
+    std::cout << "Dimensions: " << dims[0] << ", " << dims[1] << ", " << dims[2] << std::endl;
+    
+    // std::cout << "Components: " << nComp << std::endl;
+    // std::cout << "Scalar Type: " << data->GetScalarTypeAsString() << std::endl;
     
     double spacing[3];
     data->GetSpacing(spacing);
-    int x1 = static_cast<int> (_x1 / spacing[0]);
-    int y1 = static_cast<int> (_y1 / spacing[1]);
-    int z1 = static_cast<int> (_z1 / spacing[2]);
-    int x2 = static_cast<int> (_x2 / spacing[0]);
-    int y2 = static_cast<int> (_y2 / spacing[1]);
-    int z2 = static_cast<int> (_z2 / spacing[2]);
-    
     
-    int stepZ = z1 < z2 ? 1 : -1;
-    int stepX = x1 < x2 ? 1 : -1;
-    int stepY = y1 < y2 ? 1 : -1;
+    std::cout << "Spacing: " << spacing[0] << ", " << spacing[1] << ", " << spacing[2] << std::endl;
     
-    // the small cube bounded by (x1, y1, z1) and (x2, y2, z2)
-    unsigned width = std::abs(x2 - x1) + 1;
-    unsigned height = std::abs(y2 - y1) + 1;
-    unsigned depth = std::abs(z2 - z1) + 1;
+    std::vector<Pos3D> seam;
+    carve2D(data, energyVolume(data, IntensityFeature), _x1, _y1, _x2, _y2, _z, seam, solver, stats);
     
-    // instead of using the gradient map in 2D,
-    // let's try the intensity map here
-    std::vector< std::vector< std::vector<short> > > energy;
-    for ( unsigned i = 0; i < width; i++ )
+    // draw the seam
+    drawSeam(overlay, seam);
+}
+
+// one boundary pair of dijkstra2DPairs, carved on the thread pool
+struct PairJob
+{
+    Pos3D p1;
+    Pos3D p2;
+    std::vector<Pos3D> seam;
+    CarvingStats stats;
+};
+
+struct CarvePair
+{
+    typedef void result_type;
+    vtkImageData *data;
+    EnergyView intensity;
+    CarvingSolver solver;
+    CarvePair (vtkImageData *_data, const EnergyView& _intensity, CarvingSolver _solver)
+    : data(_data), intensity(_intensity), solver(_solver) {}
+    void operator() (PairJob& job)
     {
-        std::vector< std::vector<short> > energyInternal;
-        for (unsigned j = 0; j < height; j++)
-        {
-            std::vector<short> e(depth);
-            for (unsigned k = 0; k < depth; k++)
-                e[k] = 1000 - vxl[(z1+k*stepZ)*dims[0]*dims[1] + (y1+j*stepY)*dims[0] + (x1+i)*stepX];
-            energyInternal.push_back(e);
-        }
-        energy.push_back(energyInternal);
+        carve2D(data, intensity, job.p1.x, job.p1.y, job.p2.x, job.p2.y, job.p1.z, job.seam, solver, &job.stats);
     }
-    std::vector< Pos > path (depth);
-    for ( unsigned k = 1; k < depth-1; k++)
+};
+
+void dijkstra2DPairs ( vtkImageData *data, CarvingOverlay& overlay, const std::vector<Pos3D>& boundary1
+                     , const std::vector<Pos3D>& boundary2, bool parallel
+                     , CarvingSolver solver, CarvingStats* stats )
+{
+    std::vector<PairJob> jobs(std::min(boundary1.size(), boundary2.size()));
+    for (unsigned i = 0; i < jobs.size(); i++)
+    {
+        jobs[i].p1 = boundary1[i];
+        jobs[i].p2 = boundary2[i];
+    }
+    
+    // every pair reads the same cached feature
+    CarvePair carve(data, energyVolume(data, IntensityFeature), solver);
+    if (parallel)
+        QtConcurrent::blockingMap(jobs.begin(), jobs.end(), carve);
+    else
+        for (unsigned i = 0; i < jobs.size(); i++)
+            carve(jobs[i]);
+    
+    // all drawing happens here, in order
+    for (unsigned i = 0; i < jobs.size(); i++)
+    {
+        drawSeam(overlay, jobs[i].seam);
+        if (stats)
+        {
+            stats->nodes += jobs[i].stats.nodes;
+            stats->settled += jobs[i].stats.settled;
+        }
+    }
+}
+
+// the queries of dijkstra2DBatch that share a slice and a source, carved
+// from one tree on the thread pool
+struct BatchGroup
+{
+    Pos3D source;                 // in voxel index
+    std::vector<Pos3D> targets;   // in voxel index
+    std::vector<unsigned> query;  // the query and target each target came from
+    std::vector<unsigned> index;
+    std::vector< std::vector<Pos3D> > seams;
+    CarvingStats stats;
+};
+
+struct CarveGroup
+{
+    typedef void result_type;
+    EnergyView intensity;
+    CarveGroup (const EnergyView& _intensity) : intensity(_intensity) {}
+    bool inSlice (const Pos3D& p) const
+    {
+        return p.x >= 0 && p.x < intensity.width() && p.y >= 0 && p.y < intensity.height()
+            && p.z >= 0 && p.z < intensity.depth();
+    }
+    void operator() (BatchGroup& group)
+    {
+        group.seams.assign(group.targets.size(), std::vector<Pos3D>());
+        int z = group.source.z;
+        if (group.targets.empty() || !inSlice(group.source))
+            return;
+        
+        // the window is the bounding box of the source and the targets, with
+        // the 20 columns carve2D adds on its right. targets off the slice
+        // keep an empty seam
+        int x0 = group.source.x, y0 = group.source.y;
+        int x1 = x0, y1 = y0;
+        for (unsigned t = 0; t < group.targets.size(); t++)
+        {
+            const Pos3D& p = group.targets[t];
+            if (!inSlice(p))
+                continue;
+            x0 = std::min(x0, p.x);
+            y0 = std::min(y0, p.y);
+            x1 = std::max(x1, p.x);
+            y1 = std::max(y1, p.y);
+        }
+        x1 = std::min(x1 + 20, intensity.width() - 1);
+        CarvingWorkspace& work = CarvingWorkspace::local();
+        Grid<short>& gradient = work.energy;
+        short maxE = windowEnergy2D(intensity, x0, y0, z, x1 - x0 + 1, y1 - y0 + 1, gradient);
+        
+        std::vector<unsigned> targets;
+        for (unsigned t = 0; t < group.targets.size(); t++)
+            if (inSlice(group.targets[t]))
+                targets.push_back(gradient.index(group.targets[t].x - x0, group.targets[t].y - y0));
+        if (targets.empty())
+            return;
+        std::sort(targets.begin(), targets.end());
+        targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+        unsigned source = gradient.index(group.source.x - x0, group.source.y - y0);
+        search2D(gradient, maxE, work, source, &targets[0], &targets[0] + targets.size(), &group.stats);
+        
+        for (unsigned t = 0; t < group.targets.size(); t++)
+            if (inSlice(group.targets[t]))
+                traceRegion2D(work, group.targets[t].x - x0, group.targets[t].y - y0, x0, y0, z, group.seams[t]);
+    }
+};
+
+void dijkstra2DBatch ( vtkImageData *data, CarvingOverlay& overlay, std::vector<CarvingQuery>& queries, bool parallel
+                     , CarvingStats* stats )
+{
+    double spacing[3];
+    data->GetSpacing(spacing);
+    
+    // group by source voxel, which includes the slice
+    std::map<Pos3D, unsigned> groupOf;
+    std::vector<BatchGroup> groups;
+    for (unsigned q = 0; q < queries.size(); q++)
+    {
+        const Pos3D& s = queries[q].source;
+        Pos3D source(static_cast<int> (s.x / spacing[0]), static_cast<int> (s.y / spacing[1])
+                    , static_cast<int> (s.z / spacing[2]));
+        std::map<Pos3D, unsigned>::iterator it = groupOf.find(source);
+        if (it == groupOf.end())
+        {
+            it = groupOf.insert(std::make_pair(source, (unsigned)groups.size())).first;
+            groups.push_back(BatchGroup());
+            groups.back().source = source;
+        }
+        BatchGroup& group = groups[it->second];
+        for (unsigned t = 0; t < queries[q].targets.size(); t++)
+        {
+            const Pos3D& p = queries[q].targets[t];
+            group.targets.push_back(Pos3D(static_cast<int> (p.x / spacing[0]), static_cast<int> (p.y / spacing[1])
+                                         , source.z));
+            group.query.push_back(q);
+            group.index.push_back(t);
+        }
+        queries[q].seams.assign(queries[q].targets.size(), std::vector<Pos3D>());
+    }
+    
+    CarveGroup carve(energyVolume(data, IntensityFeature));
+    if (parallel)
+        QtConcurrent::blockingMap(groups.begin(), groups.end(), carve);
+    else
+        for (unsigned g = 0; g < groups.size(); g++)
+            carve(groups[g]);
+    
+    for (unsigned g = 0; g < groups.size(); g++)
+    {
+        for (unsigned t = 0; t < groups[g].targets.size(); t++)
+            queries[groups[g].query[t]].seams[groups[g].index[t]].swap(groups[g].seams[t]);
+        if (stats)
+        {
+            stats->nodes += groups[g].stats.nodes;
+            stats->settled += groups[g].stats.settled;
+        }
+    }
+    
+    // all drawing happens here, in the order of the queries
+    for (unsigned q = 0; q < queries.size(); q++)
+        for (unsigned t = 0; t < queries[q].seams.size(); t++)
+            drawSeam(overlay, queries[q].seams[t]);
+}
+
+// a mark of dijkstra2DContour whose tree gives the seams to the marks before
+// and after it, carved on the thread pool
+struct ContourTree
+{
+    unsigned root;              // grid index of the mark
+    unsigned neighbour[2];      // grid index of the marks before and after it
+    bool wanted[2];             // whether the seam to each is taken from this tree
+    std::vector<Pos3D> seam[2]; // from the mark before to this one, from this one to the mark after
+    CarvingStats stats;
+};
+
+struct CarveContour
+{
+    typedef void result_type;
+    const Grid<short>* energy;
+    short maxE;
+    int x0;
+    int y0;
+    int z;
+    CarveContour (const Grid<short>* _energy, short _maxE, int _x0, int _y0, int _z)
+    : energy(_energy), maxE(_maxE), x0(_x0), y0(_y0), z(_z) {}
+    void operator() (ContourTree& tree)
+    {
+        CarvingWorkspace& work = CarvingWorkspace::local();
+        unsigned targets[2];
+        unsigned count = 0;
+        for (int k = 0; k < 2; k++)
+            if (tree.wanted[k])
+                targets[count++] = tree.neighbour[k];
+        std::sort(targets, targets + count);
+        count = std::unique(targets, targets + count) - targets;
+        search2D(*energy, maxE, work, tree.root, targets, targets + count, &tree.stats);
+        
+        // the seam from the mark before runs down the tree to this mark as
+        // traced, the one to the mark after is turned around
+        int width = energy->width;
+        for (int k = 0; k < 2; k++)
+            if (tree.wanted[k])
+                traceRegion2D(work, tree.neighbour[k] % width, tree.neighbour[k] / width, x0, y0, z, tree.seam[k]);
+        std::reverse(tree.seam[1].begin(), tree.seam[1].end());
+    }
+};
+
+void dijkstra2DContour ( vtkImageData *data, const std::vector<Pos3D>& marks, std::vector<Pos3D>& contour
+                       , int margin, bool parallel, CarvingStats* stats )
+{
+    contour.clear();
+    unsigned n = marks.size();
+    if (n < 2)
+        return;
+    
+    int dims [3];
+    data->GetDimensions(dims);
+    double spacing[3];
+    data->GetSpacing(spacing);
+    
+    // the bounding box of the marks, margin pixels wider within the slice
+    std::vector<Pos3D> voxels(n);
+    int x1 = dims[0], y1 = dims[1], x2 = 0, y2 = 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+        voxels[i] = Pos3D(static_cast<int> (marks[i].x / spacing[0]), static_cast<int> (marks[i].y / spacing[1])
+                         , static_cast<int> (marks[i].z / spacing[2]));
+        if (voxels[i].z != voxels[0].z)
+        {
+            std::cout << "dijkstra2DContour: the marks are not on one slice" << std::endl;
+            return;
+        }
+        x1 = std::min(x1, voxels[i].x);
+        y1 = std::min(y1, voxels[i].y);
+        x2 = std::max(x2, voxels[i].x);
+        y2 = std::max(y2, voxels[i].y);
+    }
+    int z = voxels[0].z;
+    x1 = std::max(x1 - margin, 0);
+    y1 = std::max(y1 - margin, 0);
+    x2 = std::min(x2 + margin, dims[0] - 1);
+    y2 = std::min(y2 + margin, dims[1] - 1);
+    
+    Grid<short> energy;
+    short maxE = windowEnergy2D(energyVolume(data, IntensityFeature), x1, y1, z, x2 - x1 + 1, y2 - y1 + 1, energy);
+    
+    // the seam from mark i to i+1 comes from the tree of i when i is even and
+    // from the one of i+1 otherwise, which is mark 0 for the last seam of an
+    // even number of marks. for an odd number the last seam joins two even
+    // marks and is taken from the tree of the last one
+    std::vector<ContourTree> trees((n + 1) / 2);
+    for (unsigned t = 0; t < trees.size(); t++)
+    {
+        unsigned k = 2 * t;
+        const Pos3D* p[3] = { &voxels[(k + n - 1) % n], &voxels[k], &voxels[(k + 1) % n] };
+        trees[t].root = energy.index(p[1]->x - x1, p[1]->y - y1);
+        trees[t].neighbour[0] = energy.index(p[0]->x - x1, p[0]->y - y1);
+        trees[t].neighbour[1] = energy.index(p[2]->x - x1, p[2]->y - y1);
+        trees[t].wanted[0] = k > 0 || n % 2 == 0;
+        trees[t].wanted[1] = true;
+    }
+    
+    CarveContour carve(&energy, maxE, x1, y1, z);
+    if (parallel)
+        QtConcurrent::blockingMap(trees.begin(), trees.end(), carve);
+    else
+        for (unsigned t = 0; t < trees.size(); t++)
+            carve(trees[t]);
+    
+    // the loop from mark 0 on, each seam without its last voxel, which is
+    // the first of the next one
+    for (unsigned i = 0; i < n; i++)
+    {
+        const std::vector<Pos3D>& seam = i % 2 == 0 ? trees[i / 2].seam[1] : trees[((i + 1) % n) / 2].seam[0];
+        contour.insert(contour.end(), seam.begin(), seam.end() - 1);
+    }
+    if (stats)
+        for (unsigned t = 0; t < trees.size(); t++)
+        {
+            stats->nodes += trees[t].stats.nodes;
+            stats->settled += trees[t].stats.settled;
+        }
+}
+
+// input: voxcel location in index
+void dijkstra2DEx ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _x2, int _y2, int _z )
+{
+    int dims [3]; // dimension of the image data
+    data->GetDimensions(dims);
+    const int nComp = data->GetNumberOfScalarComponents(); // number of components
+    // std::cout << "Scalar Type: " << data->GetScalarTypeAsString() << std::endl;
+    
+    // the gradient magnitude of every voxel, computed once per volume
+    EnergyView gradientMap = energyVolume(data, GradientFeature);
+    
+    double spacing[3];
+    data->GetSpacing(spacing);
+    int x1 = static_cast<int> (_x1 / spacing[0]);
+    int y1 = static_cast<int> (_y1 / spacing[1]);
+    int z = static_cast<int> (_z / spacing[2]);
+    int x2 = static_cast<int> (_x2 / spacing[0]);
+    int y2 = static_cast<int> (_y2 / spacing[1]);
+    
+    // the small rectangular region bounded by (x1, y1) and (x2, y2)
+    unsigned width = std::abs(x2 - x1) + 1;
+    unsigned height = std::abs(y2 - y1) + 1;
+    
+    // prepare the gradient map
+    CarvingWorkspace& work = CarvingWorkspace::local();
+    Grid<short>& gradient = work.energy;
+    gradient.resize(width, height);
+    short maxG = 0;
+    for (unsigned j = 0; j < height; j++)
+    {
+        const short* row = gradientMap.row(y1+j, z) + x1;
+        for (unsigned i = 0; i < width; i++)
+        {
+            gradient(i, j) = row[i];
+            if (gradient(i, j) > maxG)
+                maxG = gradient(i, j);
+        }
+    }
+    // we prefer high gradient
+    short maxE = 0; // largest edge weight, bounds the bucket queue
+    for (size_t n = 0; n < gradient.size(); n++)
+    {
+        gradient[n] = clampEnergy(maxG - gradient[n]);
+        if (gradient[n] > maxE)
+            maxE = gradient[n];
+    }
+    
+    search2D(gradient, maxE, work, gradient.index(width-1, height-1));
+    
+    std::vector<Pos3D> seam;
+    trace2D(work, Pos(width-1, height-1), x1, y1, z, seam);
+    
+    // draw the seam
+    drawSeam(overlay, seam);
+}
+
+
+// in the 3D search, we impose the constrain that the graph is one directional along z axis
+// meaning that the edges are directed only along z1 -> z2
+// also, we want one voxel per z, so no planar edge is added.
+// leaving a voxel costs its energy, and from (x, y, z) we may step to any
+// (x+i, y+j, z+1) with |i|, |j| <= stepW.
+// both solvers below return the path from (0, 0, 0) to the far corner of
+// the box, one voxel per layer, or an empty path if the corner is unreachable.
+
+// the largest window search3D can take: its move codes, one per window
+// offset, have to fit in a byte
+static const int maxSearchStepW = 7;
+
+// dijkstra over the box, maxE bounds the energy. it stops as soon as the far
+// corner is settled. move (i, j) is coded (j + stepW) * (2*stepW + 1) + (i + stepW)
+static void search3D ( const Grid<short>& energy, short maxE, int stepW, std::vector<Pos3D>& path
+                     , CarvingStats* stats )
+{
+    int width = energy.width;
+    int height = energy.height;
+    int depth = energy.depth;
+    size_t area = static_cast<size_t>(width) * height;
+    int side = 2*stepW + 1;
+    
+    // the nodes construct a 3D graph now
+    SearchGrid nodes;
+    nodes.assign(width, height, depth);
+    Grid<unsigned>& distance = nodes.distance;
+    distance[0] = 0;
+    
+    BucketQueue<unsigned> queue(maxE);
+    queue.push(0, 0);
+    unsigned target = distance.size() - 1;
+    size_t settled = 0;
+    
+    while (!queue.empty())
+    {
+        unsigned key;
+        unsigned n = queue.pop(key);
+        unsigned d = distance[n];
+        if (key > d)
+            continue; // stale entry, the node is already settled
+        settled++;
+        if (n == target)
+            break;
+        int z = n / area;
+        int y = (n % area) / width;
+        int x = n % width;
+        if (z + 1 >= depth)
+            continue;
+        
+        // consider the candidates, all of them pay the energy of this voxel
+        unsigned newDistance = d + energy[n];
+        for (int j = std::max(-stepW, -y); j <= std::min(stepW, height - 1 - y); j++)
+        {
+            unsigned row = static_cast<unsigned>(distance.index(0, y + j, z + 1));
+            for (int i = std::max(-stepW, -x); i <= std::min(stepW, width - 1 - x); i++)
+            {
+                unsigned next = row + x + i;
+                if (newDistance < distance[next])
+                {
+                    distance[next] = newDistance;
+                    nodes.move[next] = (j + stepW) * side + (i + stepW);
+                    queue.push(next, newDistance);
+                }
+            }
+        }
+        
+    };
+    
+    if (stats)
+    {
+        stats->nodes += distance.size();
+        stats->settled += settled;
+    }
+    
+    path.clear();
+    Pos3D backward(width-1, height-1, depth-1);
+    if (distance(backward.x, backward.y, backward.z) == UINT_MAX)
+        return; // never reached
+    
+    path.push_back(backward);
+    while (backward.z > 0)
+    {
+        unsigned char c = nodes.move(backward.x, backward.y, backward.z);
+        backward.x -= c % side - stepW;
+        backward.y -= c / side - stepW;
+        backward.z--;
+        path.push_back(backward);
+    };
+}
+
+// the graph of search3D: leaving a voxel costs its energy, and the window
+// offset (i, j) of a step is coded as in search3D. a forward parent is one
+// layer down, a backward parent one layer up
+struct Graph3D
+{
+    const Grid<short>& energy;
+    int width;
+    int height;
+    int depth;
+    int stepW;
+    int side;
+    Graph3D (const Grid<short>& _energy, int _stepW)
+    : energy(_energy), width(_energy.width), height(_energy.height), depth(_energy.depth)
+    , stepW(_stepW), side(2*_stepW + 1) {}
+    
+    void assign (SearchGrid& nodes) const { nodes.assign(width, height, depth); }
+    int maxDegree () const { return side * side; }
+    
+    // the window of n on layer z + dz
+    int window (unsigned n, int dz, unsigned* next, unsigned char* code) const
+    {
+        size_t area = static_cast<size_t>(width) * height;
+        int z = n / area;
+        int y = (n % area) / width;
+        int x = n % width;
+        if (z + dz < 0 || z + dz >= depth)
+            return 0;
+        int degree = 0;
+        for (int j = std::max(-stepW, -y); j <= std::min(stepW, height - 1 - y); j++)
+            for (int i = std::max(-stepW, -x); i <= std::min(stepW, width - 1 - x); i++)
+            {
+                next[degree] = energy.index(x + i, y + j, z + dz);
+                code[degree] = (j + stepW) * side + (i + stepW);
+                degree++;
+            }
+        return degree;
+    }
+    int successors (unsigned n, unsigned* next, unsigned* weight, unsigned char* code) const
+    {
+        int degree = window(n, 1, next, code);
+        for (int m = 0; m < degree; m++)
+            weight[m] = energy[n];
+        return degree;
+    }
+    int predecessors (unsigned n, unsigned* prev, unsigned* weight, unsigned char* code) const
+    {
+        int degree = window(n, -1, prev, code);
+        for (int m = 0; m < degree; m++)
+            weight[m] = energy[prev[m]];
+        return degree;
+    }
+    // the node reached by (i, j) from the parent is (x + i, y + j) of the
+    // next layer in the forward tree, of the one below in the backward tree
+    unsigned forwardParent (unsigned n, unsigned char c) const
+    {
+        int i = c % side - stepW;
+        int j = c / side - stepW;
+        return n - (static_cast<size_t>(width) * height + j * width + i);
+    }
+    unsigned backwardParent (unsigned n, unsigned char c) const
+    {
+        int i = c % side - stepW;
+        int j = c / side - stepW;
+        return n + (static_cast<size_t>(width) * height - j * width - i);
+    }
+    // the code of the same edge seen from its other end, (-i, -j)
+    unsigned char reverseMove (unsigned char c) const
+    {
+        return side * side - 1 - c;
+    }
+};
+
+// the A* bound of the 3D graphs. from layer k < depth-1 a path leaves the
+// node itself and then one voxel of each layer up to depth-2, so it pays at
+// least e(n) plus the minima of those layers. across an edge the bound drops
+// by e(n) less something non-negative, so it is consistent. the last layer
+// is left by nobody, its bound is 0
+struct Heuristic3D
+{
+    const Grid<short>& energy;
+    std::vector<unsigned> above; // above[k] = sum of the minima of layers k .. depth-2
+    size_t area;
+    Heuristic3D (const Grid<short>& _energy)
+    : energy(_energy), above(_energy.depth + 1, 0)
+    , area(static_cast<size_t>(_energy.width) * _energy.height)
+    {
+        for (int k = (int)energy.depth - 2; k >= 0; k--)
+        {
+            const short* layer = &energy(0, 0, k);
+            unsigned layerMin = *std::min_element(layer, layer + area);
+            above[k] = above[k+1] + layerMin;
+        }
+    }
+    unsigned operator() (unsigned n) const
+    {
+        unsigned k = n / area;
+        if (k + 1 >= energy.depth)
+            return 0;
+        return energy[n] + above[k+1];
+    }
+};
+
+// van Herk / Gil-Werman running minimum along one axis:
+// out[x] = min of in[x-r .. x+r] (clipped to [0, n)) at three comparisons per
+// value, whatever r is. the input is padded by r on both sides and cut into
+// blocks of 2r+1; g holds the prefix minima and h the suffix minima of each
+// block, and any window then spans at most two blocks: min(h[x], g[x+2r]).
+// consecutive values along the axis are stride apart and each carries lanes
+// contiguous values, so the same code runs along x (stride 1, lanes 1) and
+// along y with whole rows as lanes (stride = lanes = width).
+static void slidingMin ( const unsigned* in, unsigned* out, int n, int r, int stride, int lanes
+                       , std::vector<unsigned>& g, std::vector<unsigned>& h )
+{
+    const unsigned INF = UINT_MAX;
+    int K = 2*r + 1;
+    int m = (n + 2*r + K - 1) / K * K; // padded length in whole blocks
+    g.resize(static_cast<size_t>(m) * lanes);
+    h.resize(static_cast<size_t>(m) * lanes);
+    
+    for (int b = 0; b < m; b += K)
+    {
+        for (int i = b; i < b + K; i++)
+        {
+            unsigned* gi = &g[static_cast<size_t>(i) * lanes];
+            const unsigned* src = (i >= r && i < r + n) ? in + static_cast<size_t>(i - r) * stride : NULL;
+            if (i == b)
+                for (int l = 0; l < lanes; l++)
+                    gi[l] = src ? src[l] : INF;
+            else if (src)
+                for (int l = 0; l < lanes; l++)
+                    gi[l] = std::min(gi[l - lanes], src[l]);
+            else
+                for (int l = 0; l < lanes; l++)
+                    gi[l] = gi[l - lanes];
+        }
+        for (int i = b + K - 1; i >= b; i--)
+        {
+            unsigned* hi = &h[static_cast<size_t>(i) * lanes];
+            const unsigned* src = (i >= r && i < r + n) ? in + static_cast<size_t>(i - r) * stride : NULL;
+            if (i == b + K - 1)
+                for (int l = 0; l < lanes; l++)
+                    hi[l] = src ? src[l] : INF;
+            else if (src)
+                for (int l = 0; l < lanes; l++)
+                    hi[l] = std::min(hi[l + lanes], src[l]);
+            else
+                for (int l = 0; l < lanes; l++)
+                    hi[l] = hi[l + lanes];
+        }
+    }
+    
+    for (int x = 0; x < n; x++)
+    {
+        const unsigned* hx = &h[static_cast<size_t>(x) * lanes];
+        const unsigned* gx = &g[static_cast<size_t>(x + 2*r) * lanes];
+        unsigned* o = out + static_cast<size_t>(x) * stride;
+        for (int l = 0; l < lanes; l++)
+            o[l] = std::min(hx[l], gx[l]);
+    }
+}
+
+// the graph is a DAG of layers, so instead of a queue we sweep z once:
+// D(p, k) = min over the window w(p) of ( D(q, k-1) + e(q, k-1) ).
+// the window is a square, so its minimum is separable: a running minimum
+// along x and then one along y, each at constant cost per voxel. this is
+// what makes wide connectivity windows affordable.
+struct LayerSweep
+{
+    std::vector<unsigned> leave; // cost of leaving each voxel of the previous layer
+    std::vector<unsigned> rowMin;
+    std::vector<unsigned> g, h;
+    
+    // D of layer k from D of layer k-1 in prev
+    void operator() ( const Grid<short>& energy, int stepW, int k, const unsigned* prev, unsigned* out )
+    {
+        const unsigned INF = UINT_MAX;
+        int width = energy.width;
+        int height = energy.height;
+        size_t area = static_cast<size_t>(width) * height;
+        leave.resize(area);
+        rowMin.resize(area);
+        const short* e = &energy(0, 0, k-1);
+        for (size_t n = 0; n < area; n++)
+            leave[n] = prev[n] == INF ? INF : prev[n] + e[n];
+        
+        for (int y = 0; y < height; y++)
+            slidingMin(&leave[y * width], &rowMin[y * width], width, stepW, 1, 1, g, h);
+        slidingMin(&rowMin[0], out, height, stepW, width, width, g, h);
+    }
+};
+
+// walking back: the predecessor is any window voxel of layer k-1 whose
+// leaving cost gives exactly the distance d of pos on layer k
+static void stepBack ( const Grid<short>& energy, int stepW, const unsigned* prev, Pos3D& pos, unsigned& d )
+{
+    int width = energy.width;
+    int height = energy.height;
+    int k = pos.z;
+    for (int j = -stepW; j <= stepW; j++)
+        for (int i = -stepW; i <= stepW; i++)
+        {
+            int x = pos.x + i;
+            int y = pos.y + j;
+            if (x < 0 || x >= width || y < 0 || y >= height)
+                continue;
+            unsigned q = prev[y * width + x];
+            if (q != UINT_MAX && q + energy(x, y, k-1) == d)
+            {
+                pos = Pos3D(x, y, k-1);
+                d = q;
+                return;
+            }
+        }
+}
+
+// the distances of every layer are kept for the walk back when they fit in
+// budget bytes. otherwise only every span-th layer is, span about the square
+// root of the depth, and the walk back sweeps each stretch between two kept
+// layers again when it gets there: twice the sweeping for 2 sqrt(depth)
+// layers of memory instead of depth
+static void layered3D ( const Grid<short>& energy, int stepW, std::vector<Pos3D>& path
+                      , size_t budget = CarvingMemoryBudget )
+{
+    const unsigned INF = UINT_MAX;
+    int width = energy.width;
+    int height = energy.height;
+    int depth = energy.depth;
+    size_t area = static_cast<size_t>(width) * height;
+    
+    int span = 1;
+    if (energy.size() * sizeof(unsigned) > budget)
+        span = static_cast<int>(ceil(sqrt(double(depth))));
+    Grid<unsigned> kept(width, height, (depth + span - 1) / span, INF);
+    Grid<unsigned> stretch(width, height, span > 1 ? span : 0, INF); // layers of one stretch, by offset
+    std::vector<unsigned> layers[2];
+    if (span > 1)
+    {
+        layers[0].resize(area);
+        layers[1].resize(area);
+    }
+    LayerSweep sweep;
+    kept(0, 0, 0) = 0;
+    
+    const unsigned* prev = &kept(0, 0, 0);
+    for (int k = 1; k < depth; k++)
+    {
+        unsigned* out = k % span == 0 ? &kept(0, 0, k / span) : &layers[k % 2][0];
+        sweep(energy, stepW, k, prev, out);
+        prev = out;
+    }
+    
+    path.clear();
+    unsigned d = prev[area - 1];
+    if (d == INF)
+        return;
+    
+    Pos3D pos(width-1, height-1, depth-1);
+    path.push_back(pos);
+    int swept = -1; // the stretch held in stretch
+    for (int k = depth-1; k > 0; k--)
+    {
+        int below = k - 1;
+        int base = below / span;
+        const unsigned* layer = &kept(0, 0, base);
+        if (below % span != 0)
+        {
+            if (swept != base)
+            {
+                const unsigned* from = layer;
+                for (int l = base * span + 1; l <= below; l++)
+                {
+                    sweep(energy, stepW, l, from, &stretch(0, 0, l - base * span));
+                    from = &stretch(0, 0, l - base * span);
+                }
+                swept = base;
+            }
+            layer = &stretch(0, 0, below - base * span);
+        }
+        stepBack(energy, stepW, layer, pos, d);
+        path.push_back(pos);
+    }
+}
+
+// one layer of bend3D: the costs of the states of layer k into next from those
+// of layer k-1 in prev, and the move before each state into from. states of
+// a layer are move major, so a move shifts whole rows
+static void bendStep ( const Grid<short>& energy, int stepW, int bend, int k
+                     , const unsigned* prev, unsigned* next, unsigned char* from )
+{
+    const unsigned INF = UINT_MAX;
+    int width = energy.width;
+    int height = energy.height;
+    size_t area = static_cast<size_t>(width) * height;
+    int side = 2*stepW + 1;
+    int moves = side * side;
+    const short* e = &energy(0, 0, k-1);
+    std::fill(next, next + moves * area, INF);
+    for (int m = 0; m < moves; m++)
+    {
+        int i = m % side - stepW;
+        int j = m / side - stepW;
+        unsigned* out = next + m * area;
+        unsigned char* fromMove = from + m * area;
+        for (int bj = std::max(j - bend, -stepW); bj <= std::min(j + bend, stepW); bj++)
+            for (int bi = std::max(i - bend, -stepW); bi <= std::min(i + bend, stepW); bi++)
+            {
+                int before = (bj + stepW) * side + (bi + stepW);
+                const unsigned* in = prev + before * area;
+                for (int y = std::max(j, 0); y < std::min(height, height + j); y++)
+                {
+                    const unsigned* inRow = in + (y - j) * width;
+                    const short* eRow = e + (y - j) * width;
+                    unsigned* outRow = out + y * width;
+                    unsigned char* fromRow = fromMove + y * width;
+                    for (int x = std::max(i, 0); x < std::min(width, width + i); x++)
+                    {
+                        unsigned d = inRow[x - i];
+                        if (d == INF)
+                            continue;
+                        d += eRow[x - i];
+                        if (d < outRow[x])
+                        {
+                            outRow[x] = d;
+                            fromRow[x] = before;
+                        }
+                    }
+                }
+            }
+    }
+}
+
+// the bytes bend3D takes, states states a layer, when it keeps the costs
+// of every span-th layer and the moves of one stretch of span layers
+static size_t bendBytes ( size_t states, int depth, int span )
+{
+    return ((depth - 1) / span + 3) * states * sizeof(unsigned) + span * states;
+}
+
+// layered3D over states (voxel, move into it), the move coded as in search3D:
+// D(p, m) = min over the moves m' within bend of m of ( D(p - m, m') + e(p - m) ),
+// so the step of the path changes by at most bend voxels in x and in y from
+// one layer to the next. a byte per state remembers m' for the walk back.
+// the first step may be any move. like layered3D, the moves of every layer
+// are kept when they fit in budget bytes, otherwise only the costs of every
+// span-th layer are, span about the square root of the depth, and the walk
+// back sweeps each stretch again to get its moves. returns false, with no
+// path, when even that does not fit
+static bool bend3D ( const Grid<short>& energy, int stepW, int bend, std::vector<Pos3D>& path
+                   , size_t budget = CarvingMemoryBudget )
+{
+    const unsigned INF = UINT_MAX;
+    int width = energy.width;
+    int height = energy.height;
+    int depth = energy.depth;
+    size_t area = static_cast<size_t>(width) * height;
+    int side = 2*stepW + 1;
+    int moves = side * side;
+    size_t states = moves * area;
+    path.clear();
+    
+    int span = std::max(depth - 1, 1);
+    if (bendBytes(states, depth, span) > budget)
+        span = static_cast<int>(ceil(sqrt(double(depth))));
+    if (bendBytes(states, depth, span) > budget)
+        return false;
+    
+    // layer s*span of the costs is kept[s], back holds the moves of the
+    // layers of one stretch: those of layer k at (k-1) % span
+    std::vector<unsigned> kept(((depth - 1) / span + 1) * states, INF);
+    std::vector<unsigned> layers[2];
+    layers[0].resize(states);
+    layers[1].resize(states);
+    std::vector<unsigned char> back(span * states);
+    for (int m = 0; m < moves; m++)
+        kept[m * area] = 0;
+    
+    const unsigned* prev = &kept[0];
+    for (int k = 1; k < depth; k++)
+    {
+        unsigned* out = k % span == 0 ? &kept[(k / span) * states] : &layers[k % 2][0];
+        bendStep(energy, stepW, bend, k, prev, out, &back[((k - 1) % span) * states]);
+        prev = out;
+    }
+    
+    size_t target = area - 1;
+    int m = -1;
+    unsigned best = INF;
+    for (int c = 0; c < moves; c++)
+        if (prev[c * area + target] < best)
+        {
+            best = prev[c * area + target];
+            m = c;
+        }
+    if (m < 0)
+        return true;
+    
+    int x = width - 1;
+    int y = height - 1;
+    path.push_back(Pos3D(x, y, depth-1));
+    int swept = depth > 1 ? (depth - 2) / span : -1; // the stretch whose moves back holds
+    for (int k = depth-1; k > 0; k--)
+    {
+        int stretch = (k - 1) / span;
+        if (swept != stretch)
+        {
+            const unsigned* from = &kept[stretch * states];
+            for (int l = stretch * span + 1; l <= std::min((stretch + 1) * span, depth - 1); l++)
+            {
+                bendStep(energy, stepW, bend, l, from, &layers[l % 2][0], &back[((l - 1) % span) * states]);
+                from = &layers[l % 2][0];
+            }
+            swept = stretch;
+        }
+        int before = back[((k - 1) % span) * states + m * area + y * width + x];
+        x -= m % side - stepW;
+        y -= m / side - stepW;
+        path.push_back(Pos3D(x, y, k-1));
+        m = before;
+    }
+    return true;
+}
+
+// the energy of the box between (x1, y1, z1) and (x2, y2, z2), given in voxel
+// index, with (x1, y1, z1) at (0, 0, 0). returns the largest energy
+static short boxEnergy3D ( const EnergyView& intensity, int x1, int y1, int z1, int x2, int y2, int z2
+                         , Grid<short>& energy )
+{
+    int stepZ = z1 < z2 ? 1 : -1;
+    int stepX = x1 < x2 ? 1 : -1;
+    int stepY = y1 < y2 ? 1 : -1;
+    
+    // the small cube bounded by (x1, y1, z1) and (x2, y2, z2)
+    unsigned width = std::abs(x2 - x1) + 1;
+    unsigned height = std::abs(y2 - y1) + 1;
+    unsigned depth = std::abs(z2 - z1) + 1;
+    
+    // instead of using the gradient map in 2D,
+    // let's try the intensity map here
+    energy.assign(width, height, depth, 0);
+    short minE = SHRT_MAX, maxE = SHRT_MIN;
+    for (unsigned k = 0; k < depth; k++)
+        for (unsigned j = 0; j < height; j++)
+        {
+            const short* row = intensity.row(y1+j*stepY, z1+k*stepZ) + x1;
+            for (unsigned i = 0; i < width; i++)
+            {
+                short e = clampEnergy(1000 - row[(int)i*stepX]);
+                energy(i, j, k) = e;
+                if (e < minE)
+                    minE = e;
+                if (e > maxE)
+                    maxE = e;
+            }
+        }
+    
+    // 1000 - vxl goes negative on bone. every path to a node in layer k has
+    // exactly k edges, so shifting all energies by minE keeps the same optimal
+    // path and gives the non-negative integer weights the bucket queue needs
+    for (size_t n = 0; n < energy.size(); n++)
+        energy[n] = clampEnergy(energy[n] - minE);
+    return clampEnergy(maxE - minE);
+}
+
+// when stepping z, we allow a (2*stepW+1)^2 window to be feasible. without a
+// given window, take the default 5x5 or, if that cannot reach the far corner
+// of the box, the smallest window that can
+static int boxStepW ( unsigned width, unsigned height, unsigned depth )
+{
+    int stepW = 2;
+    if (depth > 1)
+        stepW = std::max(stepW, (int)((std::max(width, height) - 1 + depth - 2) / (depth - 1)));
+    return stepW;
+}
+
+// the box of dijkstra3D back in voxel index of the volume
+static void boxToVolume ( std::vector<Pos3D>& path, int x1, int y1, int z1, int x2, int y2, int z2 )
+{
+    int stepZ = z1 < z2 ? 1 : -1;
+    int stepX = x1 < x2 ? 1 : -1;
+    int stepY = y1 < y2 ? 1 : -1;
+    for (unsigned n = 0; n < path.size(); n++)
+    {
+        path[n].x = x1 + path[n].x*stepX;
+        path[n].y = y1 + path[n].y*stepY;
+        path[n].z = z1 + path[n].z*stepZ;
+    }
+}
+
+void dijkstra3D ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                 , CarvingSolver solver, int stepW, CarvingStats* stats, size_t budget )
+{
+    
+    int dims [3];
+    data->GetDimensions(dims);
+    EnergyView intensity = energyVolume(data, IntensityFeature);
+    
+    double spacing[3];
+    data->GetSpacing(spacing);
+    int x1 = static_cast<int> (_x1 / spacing[0]);
+    int y1 = static_cast<int> (_y1 / spacing[1]);
+    int z1 = static_cast<int> (_z1 / spacing[2]);
+    int x2 = static_cast<int> (_x2 / spacing[0]);
+    int y2 = static_cast<int> (_y2 / spacing[1]);
+    int z2 = static_cast<int> (_z2 / spacing[2]);
+    
+    
+    Grid<short> energy;
+    short maxE = boxEnergy3D(intensity, x1, y1, z1, x2, y2, z2, energy);
+    unsigned width = energy.width;
+    unsigned height = energy.height;
+    
+    std::vector<Pos3D> path;
+    if (stepW <= 0)
+        stepW = boxStepW(width, height, energy.depth);
+    // windows too wide for the move codes of the dijkstra searches go to
+    // the layered solver, which finds a path of the same cost, and so do
+    // boxes whose search grids would not fit the budget. bidirectional
+    // search keeps one grid per direction
+    size_t searchBytes = energy.size() * (sizeof(unsigned) + 1) * (solver == BidirectionalSolver ? 2 : 1);
+    if (solver == LayeredSolver || stepW > maxSearchStepW || searchBytes > budget)
+    {
+        layered3D(energy, stepW, path, budget);
+        // the sweep visits every voxel
+        if (stats)
+        {
+            stats->nodes += energy.size();
+            stats->settled += energy.size();
+        }
+    }
+    else if (solver == BidirectionalSolver || solver == AStarSolver)
+    {
+        std::vector<unsigned> nodes;
+        if (solver == BidirectionalSolver)
+            bidirectionalSearch(Graph3D(energy, stepW), 0, energy.size() - 1, maxE, nodes, stats);
+        else
+            astarSearch(Graph3D(energy, stepW), Heuristic3D(energy), 0, energy.size() - 1
+                       , maxE, nodes, stats);
+        size_t area = static_cast<size_t>(width) * height;
+        for (unsigned n = 0; n < nodes.size(); n++)
+            path.push_back(Pos3D(nodes[n] % width, (nodes[n] % area) / width, nodes[n] / area));
+    }
+    else
+        search3D(energy, maxE, stepW, path, stats);
+    
+    if (path.empty())
+    {
+        std::cout << "dijkstra3D: the end point cannot be reached with a "
+                  << 2*stepW+1 << "x" << 2*stepW+1 << " window" << std::endl;
+        return;
+    }
+    
+    // show the path
+    boxToVolume(path, x1, y1, z1, x2, y2, z2);
+    // draw the seam
+    drawSeam(overlay, path);
+    
+}
+
+void dijkstra3DBend ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                    , int bend, int stepW, CarvingStats* stats, size_t budget )
+{
+    EnergyView intensity = energyVolume(data, IntensityFeature);
+    
+    double spacing[3];
+    data->GetSpacing(spacing);
+    int x1 = static_cast<int> (_x1 / spacing[0]);
+    int y1 = static_cast<int> (_y1 / spacing[1]);
+    int z1 = static_cast<int> (_z1 / spacing[2]);
+    int x2 = static_cast<int> (_x2 / spacing[0]);
+    int y2 = static_cast<int> (_y2 / spacing[1]);
+    int z2 = static_cast<int> (_z2 / spacing[2]);
+    
+    Grid<short> energy;
+    boxEnergy3D(intensity, x1, y1, z1, x2, y2, z2, energy);
+    if (stepW <= 0)
+        stepW = boxStepW(energy.width, energy.height, energy.depth);
+    bend = std::max(bend, 0);
+    
+    std::vector<Pos3D> path;
+    // the moves have to fit in the byte kept per state
+    if (stepW <= maxSearchStepW)
+    {
+        if (!bend3D(energy, stepW, bend, path, budget))
+        {
+            std::cout << "dijkstra3DBend: the states of a " << 2*stepW+1 << "x" << 2*stepW+1
+                      << " window do not fit in " << (budget >> 20) << " MB" << std::endl;
+            return;
+        }
+        if (stats)
+        {
+            size_t states = energy.size() * (2*stepW + 1) * (2*stepW + 1);
+            stats->nodes += states;
+            stats->settled += states;
+        }
+    }
+    
+    if (path.empty())
+    {
+        std::cout << "dijkstra3DBend: the end point cannot be reached with a "
+                  << 2*stepW+1 << "x" << 2*stepW+1 << " window and a bend of " << bend << std::endl;
+        return;
+    }
+    
+    boxToVolume(path, x1, y1, z1, x2, y2, z2);
+    drawSeam(overlay, path);
+}
+
+// a level of the pyramid of dijkstra3DPyramid, read straight from the volume
+// as it is asked for. voxel (i, j, k) is the mean energy of the block of
+// scale^3 voxels of the box of boxEnergy3D that it covers, cut by the border,
+// so scale 1 is the box energy itself. depth and the sides shrink to match
+struct PyramidLevel
+{
+    const EnergyView& intensity;
+    int x1, y1, z1;
+    int stepX, stepY, stepZ;
+    unsigned boxWidth, boxHeight, boxDepth;
+    short minE;
+    unsigned scale;
+    unsigned width, height, depth;
+    PyramidLevel (const EnergyView& _intensity, int _x1, int _y1, int _z1, int x2, int y2, int z2
+                 , short _minE, unsigned _scale)
+    : intensity(_intensity), x1(_x1), y1(_y1), z1(_z1)
+    , stepX(_x1 < x2 ? 1 : -1), stepY(_y1 < y2 ? 1 : -1), stepZ(_z1 < z2 ? 1 : -1)
+    , boxWidth(std::abs(x2 - _x1) + 1), boxHeight(std::abs(y2 - _y1) + 1), boxDepth(std::abs(z2 - _z1) + 1)
+    , minE(_minE), scale(_scale)
+    , width((boxWidth + _scale - 1) / _scale), height((boxHeight + _scale - 1) / _scale)
+    , depth((boxDepth + _scale - 1) / _scale) {}
+    
+    short operator() (unsigned i, unsigned j, unsigned k) const
+    {
+        int sum = 0;
+        int count = 0;
+        for (unsigned z = k*scale; z < std::min((k+1)*scale, boxDepth); z++)
+            for (unsigned y = j*scale; y < std::min((j+1)*scale, boxHeight); y++)
+            {
+                const short* row = intensity.row(y1 + (int)y*stepY, z1 + (int)z*stepZ) + x1;
+                for (unsigned x = i*scale; x < std::min((i+1)*scale, boxWidth); x++)
+                {
+                    sum += clampEnergy(clampEnergy(1000 - row[(int)x*stepX]) - minE);
+                    count++;
+                }
+            }
+        return static_cast<short>(sum / count);
+    }
+};
+
+// layered3D inside a tube: on layer k only the square of half width r around
+// centre[k] is swept. the running minima of a layer are taken over the square
+// widened by stepW, so a layer costs (2r+1 + 2stepW)^2 whatever the size of
+// the box, and only the energies inside the tube are read. path as layered3D,
+// empty if the far corner cannot be reached inside the tube
+template<typename Energy>
+static void tube3D ( const Energy& energy, const std::vector<Pos3D>& centre, int r, int stepW
+                   , std::vector<Pos3D>& path )
+{
+    const unsigned INF = UINT_MAX;
+    int width = energy.width;
+    int height = energy.height;
+    int depth = energy.depth;
+    int side = 2*r + 1;
+    int wide = side + 2*stepW;
+    
+    // dist(i, j, k) is voxel (centre[k].x - r + i, centre[k].y - r + j, k)
+    Grid<unsigned> dist(side, side, depth, INF);
+    std::vector<unsigned> leave(static_cast<size_t>(wide) * wide);
+    std::vector<unsigned> rowMin(leave.size());
+    std::vector<unsigned> windowMin(leave.size());
+    std::vector<unsigned> g, h;
+    if (centre[0].x <= r && centre[0].y <= r)
+        dist(r - centre[0].x, r - centre[0].y, 0) = 0;
+    
+    for (int k = 1; k < depth; k++)
+    {
+        // the previous square, as leaving costs placed in the widened one
+        int ox = centre[k].x - r - stepW;
+        int oy = centre[k].y - r - stepW;
+        std::fill(leave.begin(), leave.end(), INF);
+        for (int j = 0; j < side; j++)
+            for (int i = 0; i < side; i++)
+            {
+                unsigned d = dist(i, j, k-1);
+                int x = centre[k-1].x - r + i;
+                int y = centre[k-1].y - r + j;
+                if (d == INF || x - ox < 0 || x - ox >= wide || y - oy < 0 || y - oy >= wide)
+                    continue;
+                leave[(y - oy) * wide + (x - ox)] = d + energy(x, y, k-1);
+            }
+        
+        for (int y = 0; y < wide; y++)
+            slidingMin(&leave[y * wide], &rowMin[y * wide], wide, stepW, 1, 1, g, h);
+        slidingMin(&rowMin[0], &windowMin[0], wide, stepW, wide, wide, g, h);
+        
+        for (int j = 0; j < side; j++)
+            for (int i = 0; i < side; i++)
+            {
+                int x = centre[k].x - r + i;
+                int y = centre[k].y - r + j;
+                if (x >= 0 && x < width && y >= 0 && y < height)
+                    dist(i, j, k) = windowMin[(j + stepW) * wide + (i + stepW)];
+            }
+    }
+    
+    path.clear();
+    Pos3D pos(width-1, height-1, depth-1);
+    int i = pos.x - (centre[depth-1].x - r);
+    int j = pos.y - (centre[depth-1].y - r);
+    if (i < 0 || i >= side || j < 0 || j >= side || dist(i, j, depth-1) == INF)
+        return;
+    
+    // walk back as layered3D does, within the squares
+    path.push_back(pos);
+    for (int k = depth-1; k > 0; k--)
+    {
+        unsigned d = dist(pos.x - (centre[k].x - r), pos.y - (centre[k].y - r), k);
+        bool found = false;
+        for (int b = -stepW; b <= stepW && !found; b++)
+            for (int a = -stepW; a <= stepW && !found; a++)
+            {
+                int x = pos.x + a;
+                int y = pos.y + b;
+                int pi = x - (centre[k-1].x - r);
+                int pj = y - (centre[k-1].y - r);
+                if (pi < 0 || pi >= side || pj < 0 || pj >= side)
+                    continue;
+                unsigned q = dist(pi, pj, k-1);
+                if (q != INF && q + energy(x, y, k-1) == d)
+                {
+                    pos = Pos3D(x, y, k-1);
+                    found = true;
+                }
+            }
+        path.push_back(pos);
+    }
+}
+
+// the cost of a path from the far corner back to (0, 0, 0): every voxel but
+// the last one is left
+template<typename Energy>
+static unsigned pathCost ( const Energy& energy, const std::vector<Pos3D>& path )
+{
+    unsigned cost = 0;
+    for (unsigned n = 1; n < path.size(); n++)
+        cost += energy(path[n].x, path[n].y, path[n].z);
+    return cost;
+}
+
+void dijkstra3DPyramid ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                       , int levels, int band, int stepW, PyramidReport* report )
+{
+    EnergyView intensity = energyVolume(data, IntensityFeature);
+    QTime timer;
+    timer.start();
+    
+    double spacing[3];
+    data->GetSpacing(spacing);
+    int x1 = static_cast<int> (_x1 / spacing[0]);
+    int y1 = static_cast<int> (_y1 / spacing[1]);
+    int z1 = static_cast<int> (_z1 / spacing[2]);
+    int x2 = static_cast<int> (_x2 / spacing[0]);
+    int y2 = static_cast<int> (_y2 / spacing[1]);
+    int z2 = static_cast<int> (_z2 / spacing[2]);
+    
+    // the shift of boxEnergy3D, from the brightest voxel of the box
+    short maxV = SHRT_MIN;
+    for (int z = std::min(z1, z2); z <= std::max(z1, z2); z++)
+        for (int y = std::min(y1, y2); y <= std::max(y1, y2); y++)
+        {
+            const short* row = intensity.row(y, z);
+            maxV = std::max(maxV, *std::max_element(row + std::min(x1, x2), row + std::max(x1, x2) + 1));
+        }
+    short minE = clampEnergy(1000 - maxV);
+    
+    // level l averages 2^l voxels a side. a level is only used while the
+    // one below it has a few voxels to spare on each side
+    PyramidLevel full(intensity, x1, y1, z1, x2, y2, z2, minE, 1);
+    if (stepW <= 0)
+        stepW = boxStepW(full.width, full.height, full.depth);
+    band = std::max(band, 1);
+    int top = 0;
+    while (top < levels)
+    {
+        PyramidLevel below(intensity, x1, y1, z1, x2, y2, z2, minE, 1u << top);
+        if (below.width < 8 || below.height < 8 || below.depth < 8)
+            break;
+        top++;
+    }
+    
+    // the coarsest level in full, a window of stepW voxels per layer there
+    // spans the same slope as at full resolution
+    PyramidLevel coarsest(intensity, x1, y1, z1, x2, y2, z2, minE, 1u << top);
+    Grid<short> energy(coarsest.width, coarsest.height, coarsest.depth);
+    for (unsigned k = 0; k < energy.depth; k++)
+        for (unsigned j = 0; j < energy.height; j++)
+            for (unsigned i = 0; i < energy.width; i++)
+                energy(i, j, k) = coarsest(i, j, k);
+    std::vector<Pos3D> path;
+    layered3D(energy, stepW, path);
+    
+    // each finer level searches the tube around the path of the coarser one.
+    // layer 2m follows the coarse voxel of layer m and layer 2m+1 the middle
+    // of layers m and m+1, so the centres are one window step apart at most
+    for (int level = top - 1; level >= 0 && !path.empty(); level--)
+    {
+        PyramidLevel fine(intensity, x1, y1, z1, x2, y2, z2, minE, 1u << level);
+        std::vector<Pos3D> coarse(path.rbegin(), path.rend());
+        std::vector<Pos3D> centre(fine.depth);
+        for (unsigned k = 0; k < fine.depth; k++)
+        {
+            unsigned m = k / 2;
+            unsigned m1 = k % 2 == 1 && m + 1 < coarse.size() ? m + 1 : m;
+            centre[k] = Pos3D(std::min((int)fine.width - 1, coarse[m].x + coarse[m1].x)
+                             , std::min((int)fine.height - 1, coarse[m].y + coarse[m1].y), k);
+        }
+        tube3D(fine, centre, band, stepW, path);
+    }
+    int elapsed = timer.elapsed();
+    
+    // the exact solve, for the report or when the coarse window could not
+    // make it to the far corner
+    std::vector<Pos3D> exact;
+    if (report || path.empty())
+    {
+        timer.restart();
+        boxEnergy3D(intensity, x1, y1, z1, x2, y2, z2, energy);
+        layered3D(energy, stepW, exact);
+        int exactElapsed = timer.elapsed();
+        if (path.empty())
+        {
+            path = exact;
+            elapsed += exactElapsed;
+        }
+        if (report)
+        {
+            report->levels = top;
+            report->milliseconds = elapsed;
+            report->exactMilliseconds = exactElapsed;
+            report->cost = pathCost(full, path);
+            report->exactCost = pathCost(full, exact);
+        }
+    }
+    if (path.empty())
+    {
+        std::cout << "dijkstra3DPyramid: the end point cannot be reached with a "
+                  << 2*stepW+1 << "x" << 2*stepW+1 << " window" << std::endl;
+        return;
+    }
+    
+    // show the path
+    boxToVolume(path, x1, y1, z1, x2, y2, z2);
+    // draw the seam
+    drawSeam(overlay, path);
+}
+
+// rank[i] = number of values strictly less than values[i], so equal values
+// share a rank. shorts are counted in a histogram over their range, O(n + range)
+static void rankCounting ( const std::vector<short>& values, std::vector<int>& rank )
+{
+    rank.resize(values.size());
+    if (values.empty())
+        return;
+    short lo = *std::min_element(values.begin(), values.end());
+    short hi = *std::max_element(values.begin(), values.end());
+    std::vector<int> less(hi - lo + 2, 0);
+    for (size_t i = 0; i < values.size(); i++)
+        less[values[i] - lo + 1]++;
+    for (size_t v = 1; v < less.size(); v++)
+        less[v] += less[v-1];
+    for (size_t i = 0; i < values.size(); i++)
+        rank[i] = less[values[i] - lo];
+}
+
+// the same ranking for any ordered type, by one sort and a binary search each
+template<typename T>
+static void rankSorted ( const std::vector<T>& values, std::vector<int>& rank )
+{
+    std::vector<T> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    rank.resize(values.size());
+    for (size_t i = 0; i < values.size(); i++)
+        rank[i] = std::lower_bound(sorted.begin(), sorted.end(), values[i]) - sorted.begin();
+}
+
+// ranks of unsigned values, by counting when their range is within a few
+// times their number and by sorting otherwise
+static void rankBounded ( const std::vector<unsigned>& values, std::vector<int>& rank )
+{
+    rank.resize(values.size());
+    if (values.empty())
+        return;
+    unsigned lo = *std::min_element(values.begin(), values.end());
+    unsigned hi = *std::max_element(values.begin(), values.end());
+    if (hi - lo >= 4 * values.size())
+    {
+        rankSorted(values, rank);
+        return;
+    }
+    std::vector<int> less(hi - lo + 2, 0);
+    for (size_t i = 0; i < values.size(); i++)
+        less[values[i] - lo + 1]++;
+    for (size_t v = 1; v < less.size(); v++)
+        less[v] += less[v-1];
+    for (size_t i = 0; i < values.size(); i++)
+        rank[i] = less[values[i] - lo];
+}
+
+// the searches of throughCost2D, one from each end point, and the grids
+// balancedRegion2D fills from them. like CarvingWorkspace, one per thread
+// kept across calls, see local(). separate from CarvingWorkspace::local(),
+// so a caller may hold that one
+struct ThroughSearch
+{
+    Grid<short> energy;
+    CarvingWorkspace forward;
+    CarvingWorkspace backward;
+    Grid<unsigned> through;
+    Grid<unsigned> forwardSum;
+    Grid<unsigned> backwardSum;
+    
+    static ThroughSearch& local ()
+    {
+        static QThreadStorage<ThroughSearch*> searches;
+        if (!searches.hasLocalData())
+            searches.setLocalData(new ThroughSearch);
+        return *searches.localData();
+    }
+};
+
+static bool searchThrough2D ( const EnergyView& intensity, const Grid<unsigned char>& region, int x0, int y0
+                            , const Pos3D& from, const Pos3D& to, ThroughSearch& search, Grid<unsigned>& through )
+{
+    int z = from.z;
+    short maxE = regionEnergy2D(intensity, region, x0, y0, z, search.energy);
+    through.assign(region.width, region.height, 1, UINT_MAX);
+    if (!inRegion2D(region, x0, y0, from) || !inRegion2D(region, x0, y0, to))
+        return false;
+    unsigned source = search.energy.index(from.x - x0, from.y - y0);
+    unsigned target = search.energy.index(to.x - x0, to.y - y0);
+    searchRegion2D(search.energy, maxE, region, source, UINT_MAX, search.forward);
+    if (search.forward.distance(target) == UINT_MAX)
+        return false;
+    searchRegion2D(search.energy, maxE, region, target, UINT_MAX, search.backward);
+    
+    // both distances count the pixel itself and not their own start, the
+    // seams of carveRegion2D count "to" and not "from"
+    for (size_t n = 0; n < through.size(); n++)
+        if (search.forward.distance(n) != UINT_MAX)
+            through[n] = search.forward.distance(n) + search.backward.distance(n)
+                       - search.energy[n] + search.energy[target];
+    return true;
+}
+
+void throughCost2D ( const EnergyView& intensity, const Grid<unsigned char>& region, int x0, int y0
+                   , const Pos3D& from, const Pos3D& to, Grid<unsigned>& through )
+{
+    searchThrough2D(intensity, region, x0, y0, from, to, ThroughSearch::local(), through);
+}
+
+// the sum of the region values along the tree of a search, from its source
+// to each pixel, both ends included. each pixel is summed once, from the
+// nearest ancestor already done
+static void treeSum2D ( const CarvingWorkspace& nodes, const Grid<unsigned char>& region, Grid<unsigned>& sum )
+{
+    int width = region.width;
+    sum.assign(region.width, region.height, 1, UINT_MAX);
+    std::vector<unsigned> chain;
+    for (size_t n = 0; n < sum.size(); n++)
+    {
+        if (nodes.distance(n) == UINT_MAX || sum[n] != UINT_MAX)
+            continue;
+        unsigned m = n;
+        while (sum[m] == UINT_MAX && nodes.move(m) != SearchGrid::NoMove)
+        {
+            chain.push_back(m);
+            unsigned char c = nodes.move(m);
+            m = (m / width + move2Dy[c]) * width + m % width + move2Dx[c];
+        }
+        if (sum[m] == UINT_MAX)
+            sum[m] = region[m];
+        unsigned total = sum[m];
+        while (!chain.empty())
+        {
+            total += region[chain.back()];
+            sum[chain.back()] = total;
+            chain.pop_back();
+        }
+    }
+}
+
+void balancedRegion2D ( const EnergyView& intensity, const Grid<unsigned char>& region, int x0, int y0
+                      , const Pos3D& from, const Pos3D& to, std::vector<Pos3D>& seam )
+{
+    int z = from.z;
+    seam.clear();
+    ThroughSearch& search = ThroughSearch::local();
+    Grid<unsigned>& through = search.through;
+    if (!searchThrough2D(intensity, region, x0, y0, from, to, search, through))
+        return;
+    
+    // the g of the cheapest seam through a pixel, summed along it the same
+    // way as its cost
+    Grid<unsigned>& forward = search.forwardSum;
+    Grid<unsigned>& backward = search.backwardSum;
+    treeSum2D(search.forward, region, forward);
+    treeSum2D(search.backward, region, backward);
+    std::vector<unsigned> cost;
+    std::vector<unsigned> spread;
+    std::vector<unsigned> pixel;
+    for (size_t n = 0; n < through.size(); n++)
+        if (through[n] != UINT_MAX)
+        {
+            cost.push_back(through[n]);
+            spread.push_back(forward[n] + backward[n] - region[n]);
+            pixel.push_back(n);
+        }
+    std::vector<int> rank_c;
+    std::vector<int> rank_g;
+    rankBounded(cost, rank_c);
+    rankBounded(spread, rank_g);
+    
+    // the lowest sum of ranks, the cheaper one of equal sums
+    size_t pick = 0;
+    for (size_t i = 1; i < pixel.size(); i++)
     {
+        int sum = rank_c[i] + rank_g[i];
+        int best = rank_c[pick] + rank_g[pick];
+        if (sum < best || (sum == best && cost[i] < cost[pick]))
+            pick = i;
+    }
+    
+    // "to" back to the pick along the backward tree, then on to "from"
+    int x = pixel[pick] % region.width;
+    int y = pixel[pick] / region.width;
+    traceRegion2D(search.backward, x, y, x0, y0, z, seam);
+    std::reverse(seam.begin(), seam.end());
+    seam.pop_back();
+    traceRegion2D(search.forward, x, y, x0, y0, z, seam);
+}
+
+// one slice k of averageRank3D and the candidate picked on it
+struct RankJob
+{
+    unsigned k;
+    Pos pick;
+};
+
+// picks the candidate of a slice with the lowest sum of its energy rank and
+// the rank of its distance to the line joining the corners of the box.
+// slices are independent, so they run on the thread pool
+struct RankSlice
+{
+    typedef void result_type;
+    const Grid<short>* energy;
+    RankSlice (const Grid<short>& _energy) : energy(&_energy) {}
+    void operator() (RankJob& job) const
+    {
+        unsigned width = energy->width;
+        unsigned height = energy->height;
+        unsigned depth = energy->depth;
+        unsigned k = job.k;
+        
         int d = width * height;
+        std::vector<short> e(d);
+        std::vector<double> dis(d);
         std::vector<int> rank_e(d);
         std::vector<int> rank_d(d);
         
         double center_x = (double)(width) * (double)k / (depth-1.0);
         double center_y = (double)(height) * (double)k / (depth-1.0);
         
-        int minAvgRank = d * 2;
-        int minAvgRankIdx = -1;
+        // candidate i is the voxel (i / height, i % height)
         for (int i = 0; i < d; i++) {
             int x = i / height;
             int y = i % height;
-            
-            // get the rank for energy
-            short e = energy[x][y][k];
-            int rank = 0;
-            for (int j = 0; j < d; j++) {
-                int x = j / height;
-                int y = j % height;
-                if (e > energy[x][y][k])
-                    rank++;
-            }
-            rank_e[i] = rank;
-            
-            // get the rank for distance
-            rank = 0;
-            double dis = (x - center_x)*(x - center_x) + (y - center_y)*(y - center_y);
-            for (int j = 0; j < d; j++) {
-                int x = j / height;
-                int y = j % height;
-                double dis2 = (x - center_x)*(x - center_x) + (y - center_y)*(y - center_y);
-                if (dis > dis2)
-                    rank++;
-            }
-            rank_d[i] = rank;
-            
+            e[i] = (*energy)(x, y, k);
+            dis[i] = (x - center_x)*(x - center_x) + (y - center_y)*(y - center_y);
+        }
+        
+        // the rank of a candidate is the number of candidates strictly below it
+        rankCounting(e, rank_e);
+        rankSorted(dis, rank_d);
+        
+        int minAvgRank = d * 2;
+        int minAvgRankIdx = -1;
+        for (int i = 0; i < d; i++) {
             if (rank_d[i] + rank_e[i] < minAvgRank)
             {
                 minAvgRank = rank_d[i] + rank_e[i];
                 minAvgRankIdx = i;
             }
         }
-        path[k].x = minAvgRankIdx / height;
-        path[k].y = minAvgRankIdx % height;
+        job.pick.x = minAvgRankIdx / height;
+        job.pick.y = minAvgRankIdx % height;
+    }
+};
+
+// the picks of averageRank3D, appended to picks in voxel index
+static void rankSlices3D ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                         , std::vector<Pos3D>& picks, bool parallel )
+{
+    
+    int dims [3];
+    data->GetDimensions(dims);
+    EnergyView intensity = energyVolume(data, IntensityFeature);
+    
+    double spacing[3];
+    data->GetSpacing(spacing);
+    int x1 = static_cast<int> (_x1 / spacing[0]);
+    int y1 = static_cast<int> (_y1 / spacing[1]);
+    int z1 = static_cast<int> (_z1 / spacing[2]);
+    int x2 = static_cast<int> (_x2 / spacing[0]);
+    int y2 = static_cast<int> (_y2 / spacing[1]);
+    int z2 = static_cast<int> (_z2 / spacing[2]);
+    
+    
+    int stepZ = z1 < z2 ? 1 : -1;
+    int stepX = x1 < x2 ? 1 : -1;
+    int stepY = y1 < y2 ? 1 : -1;
+    
+    // the small cube bounded by (x1, y1, z1) and (x2, y2, z2)
+    unsigned width = std::abs(x2 - x1) + 1;
+    unsigned height = std::abs(y2 - y1) + 1;
+    unsigned depth = std::abs(z2 - z1) + 1;
+    
+    // instead of using the gradient map in 2D,
+    // let's try the intensity map here
+    Grid<short> energy(width, height, depth);
+    for (unsigned k = 0; k < depth; k++)
+        for (unsigned j = 0; j < height; j++)
+        {
+            const short* row = intensity.row(y1+j*stepY, z1+k*stepZ) + x1;
+            for (unsigned i = 0; i < width; i++)
+                energy(i, j, k) = clampEnergy(1000 - row[(int)i*stepX]);
+        }
+    
+    std::vector<RankJob> jobs;
+    for ( unsigned k = 1; k < depth-1; k++)
+    {
+        RankJob job;
+        job.k = k;
+        jobs.push_back(job);
+    }
+    
+    RankSlice rank(energy);
+    if (parallel)
+        QtConcurrent::blockingMap(jobs.begin(), jobs.end(), rank);
+    else
+        for (unsigned n = 0; n < jobs.size(); n++)
+            rank(jobs[n]);
+    
+    std::vector< Pos > path (depth);
+    for (unsigned n = 0; n < jobs.size(); n++)
+    {
+        unsigned k = jobs[n].k;
+        path[k] = jobs[n].pick;
+        
+        picks.push_back(Pos3D(x1 + stepX * path[k].x, y1 + stepY * path[k].y, z1 + stepZ * k));
+    }
+}
+
+void averageRank3D ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                    , std::vector<Pos3D>& result, bool parallel)
+{
+    double spacing[3];
+    data->GetSpacing(spacing);
+    std::vector<Pos3D> picks;
+    rankSlices3D(data, _x1, _y1, _z1, _x2, _y2, _z2, picks, parallel);
+    for (unsigned n = 0; n < picks.size(); n++)
+        result.push_back(Pos3D(spacing[0] * picks[n].x, spacing[1] * picks[n].y, spacing[2] * picks[n].z));
+}
+
+void averageRank3D ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                    , bool parallel )
+{
+    std::vector<Pos3D> picks;
+    rankSlices3D(data, _x1, _y1, _z1, _x2, _y2, _z2, picks, parallel);
+    drawSeam(overlay, picks);
+}
+
+
+LiveWire::LiveWire (EnergyFeature _feature)
+: feature(_feature), volume(NULL), z(0), seeded(false), stopping(0), seed(0)
+{
+}
+
+LiveWire::~LiveWire ()
+{
+    stop();
+}
+
+void LiveWire::stop ()
+{
+    stopping.fetchAndStoreOrdered(1);
+    future.waitForFinished();
+    stopping.fetchAndStoreOrdered(0);
+    seeded = false;
+}
+
+void LiveWire::wait ()
+{
+    future.waitForFinished();
+}
+
+void LiveWire::setSeed ( vtkImageData *data, double _x, double _y, double _z )
+{
+    stop();
+    
+    int dims [3];
+    data->GetDimensions(dims);
+    data->GetSpacing(spacing);
+    int x = static_cast<int> (_x / spacing[0]);
+    int y = static_cast<int> (_y / spacing[1]);
+    z = static_cast<int> (_z / spacing[2]);
+    if (x < 0 || x >= dims[0] || y < 0 || y >= dims[1] || z < 0 || z >= dims[2])
+    {
+        seeded = false;
+        return;
+    }
+    
+    // the energy and the tree are left to grow(), off the calling thread
+    volume = data;
+    settled.assign(dims[0], dims[1], 1, 0);
+    seed = settled.index(x, y);
+    seeded = true;
+    
+    future = QtConcurrent::run(this, &LiveWire::grow);
+}
+
+// the bounds of LiveWire::grow: marks the settled nodes for trace, lets go
+// of the lock every batch nodes so that trace gets it in between, and ends
+// the search once the wire is stopping
+struct GrowBounds
+{
+    Grid<unsigned char>& settled;
+    QMutex& mutex;
+    QAtomicInt& stopping;
+    int batch;
+    GrowBounds (Grid<unsigned char>& _settled, QMutex& _mutex, QAtomicInt& _stopping)
+    : settled(_settled), mutex(_mutex), stopping(_stopping), batch(0) {}
+    
+    bool open (unsigned) const { return true; }
+    bool settle (unsigned n)
+    {
+        settled[n] = 1;
+        if (++batch == 4096)
+        {
+            batch = 0;
+            mutex.unlock();
+            mutex.lock();
+        }
+        return stopping.fetchAndAddOrdered(0) == 0;
+    }
+};
+
+// the energy of the whole slice, the grid is the slice, and search2D over
+// it from the seed. trace finds nothing settled until the search starts
+void LiveWire::grow ()
+{
+    EnergyView view = energyVolume(volume, feature);
+    if (stopping.fetchAndAddOrdered(0) != 0)
+        return;
+    int width = settled.width;
+    int height = settled.height;
+    energy.resize(width, height);
+    short maxF = SHRT_MIN;
+    for (int j = 0; j < height; j++)
+    {
+        const short* row = view.row(j, z);
+        for (int i = 0; i < width; i++)
+            maxF = std::max(maxF, row[i]);
+    }
+    short maxE = 0;
+    for (int j = 0; j < height; j++)
+    {
+        const short* row = view.row(j, z);
+        for (int i = 0; i < width; i++)
+        {
+            energy(i, j) = clampEnergy(maxF - row[i]);
+            maxE = std::max(maxE, energy(i, j));
+        }
+    }
+    
+    GrowBounds bounds(settled, mutex, stopping);
+    QMutexLocker lock(&mutex);
+    search2D(energy, maxE, nodes, seed, NULL, NULL, bounds);
+}
+
+bool LiveWire::trace ( double _x, double _y, std::vector<Pos3D>& path )
+{
+    path.clear();
+    if (!seeded)
+        return false;
+    int x = static_cast<int> (_x / spacing[0]);
+    int y = static_cast<int> (_y / spacing[1]);
+    if (x < 0 || x >= (int)settled.width || y < 0 || y >= (int)settled.height)
+        return false;
+    
+    // a settled node only leads to settled ones, whose moves are final
+    QMutexLocker lock(&mutex);
+    if (!settled(x, y))
+        return false;
+    unsigned n = settled.index(x, y);
+    path.push_back(Pos3D(x, y, z));
+    while (n != seed)
+    {
+        unsigned char c = nodes.move(n);
+        x += move2Dx[c];
+        y += move2Dy[c];
+        n = settled.index(x, y);
+        path.push_back(Pos3D(x, y, z));
+    }
+    return true;
+}
+
+
+// dijkstra over graph from the seeds, (key, node) pairs whose distance and
+// move are set already, on a tree whose other distances are all upper bounds.
+// the seeds join the queue in key order as they come within maxW of its
+// smallest key, so the bucket queue never spans more than maxW even though
+// the seeds may lie far apart. only labels that get lower are written.
+// returns the nodes settled
+template<typename Graph>
+static size_t resumeSearch ( const Graph& graph, SearchGrid& nodes
+                           , std::vector< std::pair<unsigned, unsigned> >& seeds, unsigned maxW )
+{
+    Grid<unsigned>& distance = nodes.distance;
+    std::sort(seeds.begin(), seeds.end());
+    
+    BucketQueue<unsigned> queue(maxW);
+    size_t s = 0;
+    size_t settled = 0;
+    std::vector<unsigned> next(graph.maxDegree());
+    std::vector<unsigned> weight(graph.maxDegree());
+    std::vector<unsigned char> code(graph.maxDegree());
+    
+    while (!queue.empty() || s < seeds.size())
+    {
+        unsigned top;
+        if (queue.empty())
+        {
+            top = seeds[s].first;
+            queue.rebase(top);
+        }
+        else
+            top = queue.top();
+        for (; s < seeds.size() && seeds[s].first <= top + maxW; s++)
+            queue.push(seeds[s].second, seeds[s].first);
         
-        // show the path
-        vxl[(z1 + k*stepZ) * (dims[0]*dims[1]) + (y1+path[k].y*stepY) * dims[0] + x1 + path[k].x*stepX] = 1000;
+        unsigned key;
+        unsigned n = queue.pop(key);
+        unsigned d = distance[n];
+        if (key > d)
+            continue; // stale entry, the node is already settled
+        settled++;
         
-        result.push_back(Pos3D( spacing[0] * (x1 + stepX * path[k].x)
-                              , spacing[1] * (y1 + stepY * path[k].y)
-                              , spacing[2] * (z1 + stepZ * k) ) );
+        int degree = graph.successors(n, &next[0], &weight[0], &code[0]);
+        for (int m = 0; m < degree; m++)
+        {
+            unsigned v = next[m];
+            unsigned nd = d + weight[m];
+            if (nd < distance[v])
+            {
+                distance[v] = nd;
+                nodes.move[v] = code[m];
+                queue.push(v, nd);
+            }
+        }
+    };
+    return settled;
+}
+
+// the lowest d(p) + w(p, n) over the predecessors p of n that are not marked,
+// with the move of that edge in the forward tree. INF if there is none
+template<typename Graph>
+static unsigned bestParent ( const Graph& graph, const SearchGrid& nodes, const Grid<unsigned char>& mark
+                           , unsigned n, unsigned* prev, unsigned* weight, unsigned char* code
+                           , unsigned char& move )
+{
+    unsigned best = UINT_MAX;
+    int degree = graph.predecessors(n, prev, weight, code);
+    for (int m = 0; m < degree; m++)
+    {
+        unsigned d = nodes.distance[prev[m]];
+        if (mark[prev[m]] || d == UINT_MAX)
+            continue;
+        if (d + weight[m] < best)
+        {
+            best = d + weight[m];
+            move = graph.reverseMove(code[m]);
+        }
+    }
+    return best;
+}
+
+// brings the full shortest path tree of graph from root up to date after the
+// energies of the nodes in changed moved away from old. a node whose energy
+// went up takes its subtree down with it: those nodes lose their distance
+// and are searched again from the unmarked nodes around them. a node whose
+// energy went down offers the saving to itself and to its successors, which
+// pass it on. a change reaches the edges into a node in the 2D graphs and
+// the edges out of it in the 3D ones, this covers both. mark must be all 0
+// and is left so. returns the nodes touched
+template<typename Graph>
+static size_t repairTree ( const Graph& graph, SearchGrid& nodes, unsigned root
+                         , const std::vector<unsigned>& changed, const std::vector<short>& old
+                         , unsigned maxW, Grid<unsigned char>& mark )
+{
+    Grid<unsigned>& distance = nodes.distance;
+    std::vector<unsigned> next(graph.maxDegree());
+    std::vector<unsigned> weight(graph.maxDegree());
+    std::vector<unsigned char> code(graph.maxDegree());
+    
+    // the subtrees of the nodes that got dearer, walked down through the
+    // children of each node, the successors whose parent it is
+    std::vector<unsigned> lost;
+    std::vector<unsigned> stack;
+    for (unsigned c = 0; c < changed.size(); c++)
+    {
+        unsigned u = changed[c];
+        if (graph.energy[u] <= old[c] || mark[u] || distance[u] == UINT_MAX)
+            continue;
+        if (u != root)
+        {
+            mark[u] = 1;
+            lost.push_back(u);
+        }
+        stack.push_back(u);
+        while (!stack.empty())
+        {
+            unsigned n = stack.back();
+            stack.pop_back();
+            int degree = graph.successors(n, &next[0], &weight[0], &code[0]);
+            for (int m = 0; m < degree; m++)
+            {
+                unsigned v = next[m];
+                if (mark[v] || nodes.move[v] == SearchGrid::NoMove
+                    || graph.forwardParent(v, nodes.move[v]) != n)
+                    continue;
+                mark[v] = 1;
+                lost.push_back(v);
+                stack.push_back(v);
+            }
+        }
+    }
+    for (size_t i = 0; i < lost.size(); i++)
+    {
+        distance[lost[i]] = UINT_MAX;
+        nodes.move[lost[i]] = SearchGrid::NoMove;
+    }
+    
+    // the lost nodes start from their best unmarked parent
+    std::vector< std::pair<unsigned, unsigned> > seeds;
+    std::vector<unsigned> prev(graph.maxDegree());
+    for (size_t i = 0; i < lost.size(); i++)
+    {
+        unsigned char move = SearchGrid::NoMove;
+        unsigned d = bestParent(graph, nodes, mark, lost[i], &prev[0], &weight[0], &code[0], move);
+        if (d == UINT_MAX)
+            continue;
+        distance[lost[i]] = d;
+        nodes.move[lost[i]] = move;
+        seeds.push_back(std::make_pair(d, lost[i]));
+    }
+    
+    // the nodes that got cheaper, and their successors
+    for (unsigned c = 0; c < changed.size(); c++)
+    {
+        unsigned u = changed[c];
+        if (graph.energy[u] >= old[c] || mark[u])
+            continue;
+        unsigned char move = SearchGrid::NoMove;
+        unsigned d = u == root ? UINT_MAX
+                   : bestParent(graph, nodes, mark, u, &prev[0], &weight[0], &code[0], move);
+        if (d < distance[u])
+        {
+            distance[u] = d;
+            nodes.move[u] = move;
+            seeds.push_back(std::make_pair(d, u));
+        }
+        if (distance[u] == UINT_MAX)
+            continue;
+        int degree = graph.successors(u, &next[0], &weight[0], &code[0]);
+        for (int m = 0; m < degree; m++)
+        {
+            unsigned v = next[m];
+            unsigned nd = distance[u] + weight[m];
+            if (!mark[v] && nd < distance[v])
+            {
+                distance[v] = nd;
+                nodes.move[v] = code[m];
+                seeds.push_back(std::make_pair(nd, v));
+            }
+        }
+    }
+    
+    // the lost nodes that are reached again are among the settled ones
+    size_t touched = resumeSearch(graph, nodes, seeds, maxW);
+    for (size_t i = 0; i < lost.size(); i++)
+    {
+        mark[lost[i]] = 0;
+        if (distance[lost[i]] == UINT_MAX)
+            touched++;
+    }
+    return touched;
+}
+
+
+CarvingTree::CarvingTree ()
+: volume(NULL), reversed(false), margin(0), requestedStepW(0), stepW(0), stepZ(1), offset(0)
+, featureLow(0), featureScale(1), maxE(0), root(0), lastTouched(0)
+{
+    for (int a = 0; a < 3; a++)
+        first[a] = last[a] = 0;
+    origin[0] = origin[1] = 0;
+}
+
+void CarvingTree::build ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                        , int _margin, int _stepW )
+{
+    double spacing[3];
+    data->GetSpacing(spacing);
+    first[0] = static_cast<int> (_x1 / spacing[0]);
+    first[1] = static_cast<int> (_y1 / spacing[1]);
+    first[2] = static_cast<int> (_z1 / spacing[2]);
+    reversed = false;
+    margin = std::max(_margin, 0);
+    requestedStepW = _stepW;
+    grow(data, static_cast<int> (_x2 / spacing[0]), static_cast<int> (_y2 / spacing[1])
+        , static_cast<int> (_z2 / spacing[2]));
+}
+
+// the box around first and (x2, y2, z2), its energy as dijkstra3D has it
+// and the whole tree of it from first
+void CarvingTree::grow ( vtkImageData *data, int x2, int y2, int z2 )
+{
+    int dims [3];
+    data->GetDimensions(dims);
+    EnergyView intensity = energyVolume(data, IntensityFeature);
+    volume = data;
+    featureLow = intensity.low();
+    featureScale = intensity.scale();
+    
+    int x1 = first[0];
+    int y1 = first[1];
+    int z1 = first[2];
+    stepZ = z1 < z2 ? 1 : -1;
+    origin[0] = std::max(std::min(x1, x2) - margin, 0);
+    origin[1] = std::max(std::min(y1, y2) - margin, 0);
+    unsigned width = std::min(std::max(x1, x2) + margin, dims[0] - 1) - origin[0] + 1;
+    unsigned height = std::min(std::max(y1, y2) + margin, dims[1] - 1) - origin[1] + 1;
+    int zEnd = z2 + stepZ * margin;
+    zEnd = std::max(0, std::min(zEnd, dims[2] - 1));
+    unsigned depth = std::abs(zEnd - z1) + 1;
+    
+    energy.assign(width, height, depth, 0);
+    short minE = SHRT_MAX;
+    maxE = SHRT_MIN;
+    for (unsigned k = 0; k < depth; k++)
+        for (unsigned j = 0; j < height; j++)
+        {
+            const short* row = intensity.row(origin[1] + j, z1 + k*stepZ) + origin[0];
+            for (unsigned i = 0; i < width; i++)
+            {
+                short e = clampEnergy(1000 - row[i]);
+                energy(i, j, k) = e;
+                minE = std::min(minE, e);
+                maxE = std::max(maxE, e);
+            }
+        }
+    // the same shift as dijkstra3D, every path to layer k has k edges
+    offset = minE;
+    for (size_t n = 0; n < energy.size(); n++)
+        energy[n] = clampEnergy(energy[n] - offset);
+    maxE = clampEnergy(maxE - offset);
+    
+    stepW = requestedStepW;
+    if (stepW <= 0)
+    {
+        stepW = 2;
+        int dz = std::abs(z2 - z1);
+        if (dz > 0)
+            stepW = std::max(stepW, (std::max(std::abs(x2 - x1), std::abs(y2 - y1)) + dz - 1) / dz);
+    }
+    stepW = std::min(stepW, maxSearchStepW);
+    
+    mark.assign(width, height, depth, 0);
+    nodes.assign(width, height, depth);
+    root = energy.index(x1 - origin[0], y1 - origin[1], 0);
+    nodes.distance[root] = 0;
+    std::vector< std::pair<unsigned, unsigned> > seeds(1, std::make_pair(0u, root));
+    lastTouched = resumeSearch(Graph3D(energy, stepW), nodes, seeds, maxE);
+    
+    trace(x2, y2, z2);
+}
+
+void CarvingTree::trace ( int x2, int y2, int z2 )
+{
+    last[0] = x2;
+    last[1] = y2;
+    last[2] = z2;
+    path.clear();
+    Graph3D graph(energy, stepW);
+    unsigned n = energy.index(x2 - origin[0], y2 - origin[1], (z2 - first[2]) * stepZ);
+    if (nodes.distance[n] == UINT_MAX)
+    {
+        std::cout << "CarvingTree: the end point cannot be reached with a "
+                  << 2*stepW+1 << "x" << 2*stepW+1 << " window" << std::endl;
+        return;
+    }
+    size_t area = static_cast<size_t>(energy.width) * energy.height;
+    for (;; n = graph.forwardParent(n, nodes.move[n]))
+    {
+        unsigned k = n / area;
+        path.push_back(Pos3D(origin[0] + n % energy.width, origin[1] + (n % area) / energy.width
+                            , first[2] + (int)k * stepZ));
+        if (n == root)
+            break;
+    }
+    // rooted at the second end point the walk runs from the first one.
+    // the cost of a seam counts the voxels after its start, so both ways
+    // the costs differ by the same e(first) - e(second) and the seam is
+    // a cheapest one still
+    if (reversed)
+        std::reverse(path.begin(), path.end());
+}
+
+void CarvingTree::moveEnd ( vtkImageData *data, int _x2, int _y2, int _z2 )
+{
+    double spacing[3];
+    data->GetSpacing(spacing);
+    int x2 = static_cast<int> (_x2 / spacing[0]);
+    int y2 = static_cast<int> (_y2 / spacing[1]);
+    int z2 = static_cast<int> (_z2 / spacing[2]);
+    if (reversed)
+    {
+        // root the tree at the first end point again
+        std::copy(last, last + 3, first);
+        reversed = false;
+        grow(data, x2, y2, z2);
+        return;
     }
-}
\ No newline at end of file
+    moveTip(data, x2, y2, z2);
+}
+
+void CarvingTree::moveStart ( vtkImageData *data, int _x1, int _y1, int _z1 )
+{
+    double spacing[3];
+    data->GetSpacing(spacing);
+    int x1 = static_cast<int> (_x1 / spacing[0]);
+    int y1 = static_cast<int> (_y1 / spacing[1]);
+    int z1 = static_cast<int> (_z1 / spacing[2]);
+    if (!reversed)
+    {
+        // root the tree at the second end point, which stays
+        std::copy(last, last + 3, first);
+        reversed = true;
+        grow(data, x1, y1, z1);
+        return;
+    }
+    moveTip(data, x1, y1, z1);
+}
+
+// the end point that is not the root moved to (x2, y2, z2) in voxel index
+void CarvingTree::moveTip ( vtkImageData *data, int x2, int y2, int z2 )
+{
+    int i = x2 - origin[0];
+    int j = y2 - origin[1];
+    int k = (z2 - first[2]) * stepZ;
+    if (data != volume || i < 0 || i >= (int)energy.width || j < 0 || j >= (int)energy.height
+        || k < 0 || k >= (int)energy.depth)
+    {
+        grow(data, x2, y2, z2);
+        return;
+    }
+    lastTouched = 0;
+    trace(x2, y2, z2);
+}
+
+void CarvingTree::update ( vtkImageData *data, int x0, int y0, int z0, int x1, int y1, int z1 )
+{
+    if (data != volume)
+    {
+        grow(data, last[0], last[1], last[2]);
+        return;
+    }
+    EnergyView intensity = energyVolume(data, IntensityFeature);
+    // the edit moved the range of a rescaled volume, every energy changed
+    if (intensity.low() != featureLow || intensity.scale() != featureScale)
+    {
+        grow(data, last[0], last[1], last[2]);
+        return;
+    }
+    
+    // the changed voxels inside the box, in box index
+    int lo[3] = { std::max(std::min(x0, x1) - origin[0], 0), std::max(std::min(y0, y1) - origin[1], 0), 0 };
+    int hi[3] = { std::min(std::max(x0, x1) - origin[0], (int)energy.width - 1)
+                , std::min(std::max(y0, y1) - origin[1], (int)energy.height - 1), 0 };
+    int k0 = (z0 - first[2]) * stepZ;
+    int k1 = (z1 - first[2]) * stepZ;
+    lo[2] = std::max(std::min(k0, k1), 0);
+    hi[2] = std::min(std::max(k0, k1), (int)energy.depth - 1);
+    
+    std::vector<unsigned> changed;
+    std::vector<short> old;
+    for (int k = lo[2]; k <= hi[2]; k++)
+        for (int j = lo[1]; j <= hi[1]; j++)
+        {
+            const short* row = intensity.row(origin[1] + j, first[2] + k*stepZ) + origin[0];
+            for (int i = lo[0]; i <= hi[0]; i++)
+            {
+                int e = 1000 - row[i] - offset;
+                // below the shift of the box: it has to be shifted again
+                if (e < 0)
+                {
+                    grow(data, last[0], last[1], last[2]);
+                    return;
+                }
+                unsigned n = energy.index(i, j, k);
+                if (clampEnergy(e) == energy[n])
+                    continue;
+                changed.push_back(n);
+                old.push_back(energy[n]);
+                energy[n] = clampEnergy(e);
+                maxE = std::max(maxE, energy[n]);
+            }
+        }
+    
+    lastTouched = repairTree(Graph3D(energy, stepW), nodes, root, changed, old, maxE, mark);
+    trace(last[0], last[1], last[2]);
+}
@@ -10,6 +10,13 @@
 #define ____PCarvingAlgorithm__
 
 #include "vtkImageData.h"
+#include "PCarvingGrid.h"
+#include "PCarvingWorkspace.h"
+#include "PEnergyVolume.h"
+#include <QAtomicInt>
+#include <QFuture>
+#include <QMutex>
+#include <map>
 #include <vector>
 
 
@@ -59,18 +66,301 @@ struct Pos3D
 };
 
 
-template<typename T>
-struct Node
+// what the carving routines carved, kept apart from the volume so that
+// carving leaves the data as it was read and can be run again on it. only
+// the paths are stored, in voxel index, each under its label: the first
+// path added is label 1. the views draw it over the slices
+class CarvingOverlay
 {
-    double distance;
-    T previous;
+public:
+    // returns the label of the path
+    unsigned add ( const std::vector<Pos3D>& path );
+    void clear ();
+    
+    unsigned size () const { return paths.size(); }
+    const std::vector<Pos3D>& path ( unsigned label ) const { return paths[label - 1]; }
+    // the label of the last path through the voxel, 0 if none is
+    unsigned label ( const Pos3D& voxel ) const;
+    // the carved voxels of slice index across axis, 0 for x, 1 for y, 2 for z,
+    // in the order they were first carved
+    void slice ( int axis, int index, std::vector<Pos3D>& voxels ) const;
+    
+private:
+    std::vector< std::vector<Pos3D> > paths;
+    std::map<Pos3D, unsigned> labels;
+    // each carved voxel once under its slice on every axis, so that a view
+    // does not go over all of them for each slice it draws
+    std::map< int, std::vector<Pos3D> > slices[3];
+};
+
+
+// how the carving calls search their graph. all give a path of the same
+// (minimum) cost, they may only differ in which of several equal paths is taken.
+// the 2D graphs are not layered, there the layered solver means dijkstra
+enum CarvingSolver
+{
+    DijkstraSolver,      // bucket queue search from the first end point
+    LayeredSolver,       // one dynamic programming sweep over the z layers, no queue
+    BidirectionalSolver, // bucket queue searches from both end points, meeting in between
+    AStarSolver          // bucket queue search led to the end point by a lower bound on
+                         // the cost left, taken from the energy minima of the box
+};
+
+
+// what the searches of a carving call did: the nodes of their regions and how
+// many of them were settled. the dijkstra searches stop once the end point is
+// settled, the rest of the region is skipped. stats passed in are added to
+struct CarvingStats
+{
+    size_t nodes;
+    size_t settled;
+    CarvingStats () : nodes(0), settled(0) {}
+    size_t skipped () const { return nodes - settled; }
+};
+
+
+// the memory dijkstra3D may take for the distances and moves of its search,
+// in bytes, besides the energy of the box
+const size_t CarvingMemoryBudget = size_t(256) << 20;
+
+// the routines below that return nothing add their seams to overlay, the
+// volume is only read
+// the seam of dijkstra2D runs from (_x2, _y2) back to (_x1, _y1), within the
+// bounding box of the two and 20 more columns on its right. end points off
+// the slice give no seam
+void dijkstra2D ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _x2, int _y2, int _z
+                , CarvingSolver solver = DijkstraSolver, CarvingStats* stats = NULL );
+// stepW is the half width of the window of voxels reachable from one z to the
+// next, 0 derives it from the end points. the layered solver costs the same per
+// voxel whatever the window, the dijkstra solver grows with its area but stops
+// early, which pays off between nearby end points. boxes whose search does not
+// fit in budget bytes are carved by the layered solver, which then keeps the
+// distances of only about sqrt(depth) layers and sweeps twice
+void dijkstra3D ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                 , CarvingSolver solver = LayeredSolver, int stepW = 0, CarvingStats* stats = NULL
+                 , size_t budget = CarvingMemoryBudget );
+// dijkstra3D with the bend of the seam bounded instead of only its step: the
+// step from one z to the next may change by at most bend voxels in x and in y
+// from the step before it, the discrete second derivative of g(f) <= w in
+// carving.tex. the search runs over (voxel, incoming move) states, one layer
+// at a time, so it costs (2*stepW+1)^2 * (2*bend+1)^2 per voxel and keeps a
+// byte per state. when those do not fit in budget bytes only the costs of
+// about sqrt(depth) layers are kept and the layers are swept twice, as
+// dijkstra3D does, and boxes that do not fit even so are refused.
+// stepW as dijkstra3D, up to 7
+void dijkstra3DBend ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                    , int bend = 1, int stepW = 0, CarvingStats* stats = NULL
+                    , size_t budget = CarvingMemoryBudget );
+
+// what dijkstra3DPyramid did next to the exact solve of the same box, which
+// is only run when a report is asked for. costs are in the energy of the box
+struct PyramidReport
+{
+    int levels;            // levels below full resolution
+    int milliseconds;
+    int exactMilliseconds;
+    unsigned cost;
+    unsigned exactCost;
+    PyramidReport () : levels(0), milliseconds(0), exactMilliseconds(0), cost(0), exactCost(0) {}
+    double speedup () const { return milliseconds > 0 ? double(exactMilliseconds) / milliseconds : 0; }
+    // how much dearer the seam is than the best one, 0.01 is 1%
+    double gap () const { return exactCost > 0 ? double(cost) / exactCost - 1 : 0; }
 };
 
+// dijkstra3D coarse to fine. the box energy is averaged down 2x per level
+// for up to levels levels and solved in full at the coarsest one, then each
+// finer level only searches within band voxels of the path it is given from
+// the level above. the seam may cost more than the one of dijkstra3D, a wider
+// band narrows the gap. stepW as dijkstra3D, at every level
+void dijkstra3DPyramid ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                       , int levels = 3, int band = 4, int stepW = 0, PyramidReport* report = NULL );
+
+// carve each pair (boundary1[i], boundary2[i]) on its own slice as dijkstra2D does.
+// the searches run on the thread pool when parallel, the seams are added to
+// overlay afterwards in the order of the pairs. the brain extraction dialog
+// no longer calls it, PSurfaceCarver carves its curves in windows of its own
+void dijkstra2DPairs ( vtkImageData *data, CarvingOverlay& overlay, const std::vector<Pos3D>& boundary1
+                     , const std::vector<Pos3D>& boundary2, bool parallel = true
+                     , CarvingSolver solver = DijkstraSolver, CarvingStats* stats = NULL );
+
+// one source and the targets carved from it by dijkstra2DBatch, all in world
+// units like dijkstra2D, on the slice of the source. seams are filled in, one
+// per target in voxel index, from the target back to the source
+struct CarvingQuery
+{
+    Pos3D source;
+    std::vector<Pos3D> targets;
+    std::vector< std::vector<Pos3D> > seams;
+};
+
+// many dijkstra2D calls at once. the queries are grouped by source voxel,
+// which takes in the slice, and each group builds its energy and grows its
+// tree once, until all the targets are reached. each seam is then traced
+// back from the tree. the window of a group is the bounding box of its
+// source and targets, with the 20 columns dijkstra2D adds on the right, so
+// a source with one target gets the seam of dijkstra2D. targets off the slice, and all targets of a source off it, get an
+// empty seam. groups run on the thread pool when parallel, the seams are
+// added to overlay afterwards in the order of the queries
+void dijkstra2DBatch ( vtkImageData *data, CarvingOverlay& overlay, std::vector<CarvingQuery>& queries, bool parallel = true
+                     , CarvingStats* stats = NULL );
+
+// condition 1 of carving.tex on one slice: the closed seam of least energy
+// through the marks, in their order and back to the first. the marks are in
+// world units like dijkstra2D and have to lie on one slice, the energy is
+// that of dijkstra2D over their bounding box, margin pixels wider. every
+// other mark grows one shortest path tree until the marks before and after
+// it are reached and both seams are traced from it, so n marks take (n+1)/2
+// searches, on the thread pool when parallel. contour is the loop in voxel
+// index from the first mark on, without the first voxel again at the end.
+// seams of neighbouring marks may share voxels
+void dijkstra2DContour ( vtkImageData *data, const std::vector<Pos3D>& marks, std::vector<Pos3D>& contour
+                       , int margin = 20, bool parallel = true, CarvingStats* stats = NULL );
 
-void dijkstra2D ( vtkImageData *data, int _x1, int _y1, int _x2, int _y2, int _z );
-void dijkstra3D ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2 );
+// the slices are ranked independently, on the thread pool when parallel.
+// result is in slice order either way, in world units
+void averageRank3D ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2, std::vector<Pos3D>& result
+                   , bool parallel = true );
+// the same picks added to overlay as one path, in voxel index, one voxel per
+// slice in slice order
+void averageRank3D ( vtkImageData *data, CarvingOverlay& overlay, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+                   , bool parallel = true );
 
-void averageRank3D ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2, std::vector<Pos3D>& result );
+
+// the seam of dijkstra2D from "from" to "to", both on slice from.z and in voxel
+// index, over the set (non zero) pixels of region only. region is a window of the slice
+// with its corner at (x0, y0), the energy is the intensity feature taken from
+// the maximum of the window. seam is given from "to" back to "from", empty if
+// the region does not connect them. only reads, nothing is drawn
+void carveRegion2D ( const EnergyView& intensity, const Grid<unsigned char>& region, int x0, int y0
+                   , const Pos3D& from, const Pos3D& to, std::vector<Pos3D>& seam );
+
+// the cost of the cheapest seam of carveRegion2D that passes through each
+// pixel of the region, UINT_MAX where none does. it is the distance from
+// "from" plus the distance to "to", so one search from each end gives the
+// costs of all the paths step b' of carving.tex ranks, the cheapest seam is
+// the set of pixels at the minimum
+void throughCost2D ( const EnergyView& intensity, const Grid<unsigned char>& region, int x0, int y0
+                   , const Pos3D& from, const Pos3D& to, Grid<unsigned>& through );
+
+// step b': a seam balanced between cost and connectivity g, where the value
+// of a set pixel of region is its share of g, higher further from where the
+// seam is expected. the candidates are the cheapest seams through each pixel,
+// with g summed along them from the same two searches. they are ranked by
+// cost and by g as averageRank3D ranks its candidates, and the one of the
+// lowest sum of ranks is taken. linear in the region but for the sort of
+// costs spread wider than the region is large
+void balancedRegion2D ( const EnergyView& intensity, const Grid<unsigned char>& region, int x0, int y0
+                      , const Pos3D& from, const Pos3D& to, std::vector<Pos3D>& seam );
+
+// add the curves of a carved surface to overlay, each as its own path
+void drawSurface ( CarvingOverlay& overlay, const std::vector< std::vector<Pos3D> >& curves );
+
+
+// the carving of dijkstra3D kept between edits, for marks that get nudged and
+// areas that get re-thresholded. the shortest path tree of the box is grown
+// in full from one end point, the root, so moving the other one inside the
+// box is only a walk back along the tree. moving the root changes every
+// distance of the tree, so the tree is grown again from the end point that
+// stays, and moves of the same end point after that are walks again: only
+// switching between the two end points costs a new tree. when voxels of the
+// box change, only the nodes whose distance went through them are searched
+// again and the rest of the tree is kept. the box is that of dijkstra3D,
+// margin voxels wider in x and y and deeper past the end point that is not
+// the root. windows wider than the dijkstra search takes are narrowed to it.
+// end points are in world units like dijkstra3D, the seam is given in voxel
+// index and not added anywhere
+class CarvingTree
+{
+public:
+    CarvingTree ();
+    
+    // a new tree from (_x1, _y1, _z1) and its seam to (_x2, _y2, _z2)
+    void build ( vtkImageData *data, int _x1, int _y1, int _z1, int _x2, int _y2, int _z2
+               , int _margin = 8, int _stepW = 0 );
+    // the second end point moved, outside the box or when the tree is
+    // rooted at it this builds a new tree
+    void moveEnd ( vtkImageData *data, int _x2, int _y2, int _z2 );
+    // the same for the first end point
+    void moveStart ( vtkImageData *data, int _x1, int _y1, int _z1 );
+    // the voxels in [x0, x1] x [y0, y1] x [z0, z1], in voxel index, were
+    // changed in data and data->Modified() was called
+    void update ( vtkImageData *data, int x0, int y0, int z0, int x1, int y1, int z1 );
+    
+    // from the second end point back to the first, empty if unreachable
+    const std::vector<Pos3D>& seam () const { return path; }
+    // the nodes the last build, move or update had to search
+    size_t touched () const { return lastTouched; }
+    
+private:
+    void grow ( vtkImageData *data, int x2, int y2, int z2 );
+    void moveTip ( vtkImageData *data, int x2, int y2, int z2 );
+    void trace ( int x2, int y2, int z2 );
+    
+    vtkImageData *volume;
+    int first[3];  // the root in voxel index
+    int last[3];   // the other end point in voxel index
+    bool reversed; // the root is the second end point
+    int margin;
+    int requestedStepW;
+    int stepW;
+    int origin[2]; // x and y of the box corner
+    int stepZ;
+    short offset;  // energies are 1000 - vxl - offset
+    double featureLow;   // the map of the voxels onto the feature
+    double featureScale; // the energies were read with, see EnergyView
+    short maxE;
+    
+    Grid<short> energy;
+    SearchGrid nodes;
+    Grid<unsigned char> mark; // all 0 between calls
+    unsigned root;
+    std::vector<Pos3D> path;
+    size_t lastTouched;
+};
+
+
+// intelligent scissors on one slice. setSeed returns at once and the energy
+// of the slice, with the feature volume if it is not cached yet, and the
+// shortest path tree of the whole slice from the seed are computed in the
+// background, the tree nearest nodes first, and
+// trace follows the tree from any point back to the seed as soon as the tree
+// has reached it, so moving the end point costs no search at all.
+// the energy is (slice max - feature), the gradient by default so that the
+// wire snaps to edges. coordinates are in world units like dijkstra2D
+class LiveWire
+{
+public:
+    LiveWire (EnergyFeature _feature = GradientFeature);
+    ~LiveWire ();
+    
+    // starts a tree on slice _z, stopping the one being grown
+    void setSeed ( vtkImageData *data, double _x, double _y, double _z );
+    // the path from (_x, _y) back to the seed in voxel index, false while
+    // the tree has not reached it yet
+    bool trace ( double _x, double _y, std::vector<Pos3D>& path );
+    // waits until the whole slice is reached
+    void wait ();
+    // stops growing and drops the seed
+    void stop ();
+    bool hasSeed () const { return seeded; }
+    
+private:
+    void grow ();
+    
+    EnergyFeature feature;
+    vtkImageData *volume;
+    double spacing[3];
+    int z;
+    bool seeded;
+    
+    QFuture<void> future;
+    QAtomicInt stopping; // set by stop() from the caller's thread, read by grow()
+    QMutex mutex; // guards the tree while it grows
+    Grid<short> energy;
+    CarvingWorkspace nodes;
+    Grid<unsigned char> settled;
+    unsigned seed;
+};
 
 
 #endif /* defined(____PCarvingAlgorithm__) */
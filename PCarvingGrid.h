@@ -0,0 +1,88 @@
+//
+//  PCarvingGrid.h
+//
+//  Dense grid storage shared by the carving routines.
+//
+
+#ifndef ____PCarvingGrid__
+#define ____PCarvingGrid__
+
+#include <climits>
+#include <vector>
+
+
+// A width x height x depth grid in a single allocation.
+// x runs fastest, then y, then z, the same layout as the scalars of a
+// vtkImageData, so walking a row of the grid walks a row of the volume.
+// 2D grids simply have depth 1.
+template<typename T>
+class Grid
+{
+public:
+    Grid () : width(0), height(0), depth(0) {}
+    Grid (unsigned _width, unsigned _height, unsigned _depth = 1, const T& value = T())
+    : width(_width), height(_height), depth(_depth)
+    , cells(static_cast<size_t>(_width) * _height * _depth, value) {}
+
+    void assign (unsigned _width, unsigned _height, unsigned _depth, const T& value)
+    {
+        width = _width;
+        height = _height;
+        depth = _depth;
+        cells.assign(static_cast<size_t>(width) * height * depth, value);
+    }
+
+    // a new shape without clearing: the values are left as they are and
+    // the storage only grows
+    void resize (unsigned _width, unsigned _height, unsigned _depth = 1)
+    {
+        width = _width;
+        height = _height;
+        depth = _depth;
+        size_t n = static_cast<size_t>(width) * height * depth;
+        if (n > cells.size())
+            cells.resize(n);
+    }
+
+    size_t index (unsigned x, unsigned y, unsigned z = 0) const
+    {
+        return (static_cast<size_t>(z) * height + y) * width + x;
+    }
+
+    T& operator() (unsigned x, unsigned y, unsigned z = 0) { return cells[index(x, y, z)]; }
+    const T& operator() (unsigned x, unsigned y, unsigned z = 0) const { return cells[index(x, y, z)]; }
+
+    T& operator[] (size_t i) { return cells[i]; }
+    const T& operator[] (size_t i) const { return cells[i]; }
+
+    size_t size () const { return static_cast<size_t>(width) * height * depth; }
+
+    unsigned width;
+    unsigned height;
+    unsigned depth;
+
+private:
+    std::vector<T> cells;
+};
+
+
+// what a search leaves behind, as two flat arrays instead of one struct per
+// node: the distance of each node and a one byte code of the move that
+// reached it. energies are integers, so the distances are exact in 32 bits
+// and a node takes 5 bytes
+struct SearchGrid
+{
+    enum { NoMove = 255 }; // not reached, or the start
+
+    void assign (unsigned width, unsigned height, unsigned depth = 1)
+    {
+        distance.assign(width, height, depth, UINT_MAX);
+        move.assign(width, height, depth, NoMove);
+    }
+
+    Grid<unsigned> distance;
+    Grid<unsigned char> move;
+};
+
+
+#endif /* defined(____PCarvingGrid__) */
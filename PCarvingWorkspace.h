@@ -0,0 +1,93 @@
+//
+//  PCarvingWorkspace.h
+//
+//  Scratch memory of the 2D carving searches, kept between calls.
+//
+
+#ifndef ____PCarvingWorkspace__
+#define ____PCarvingWorkspace__
+
+#include "PCarvingGrid.h"
+#include "PBucketQueue.h"
+#include <QThreadStorage>
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+
+// what a 2D carving search needs besides its input, owned across calls.
+// the arrays only ever grow, so a run of searches over regions of about
+// the same size allocates nothing after the first one. a new search does
+// not clear the nodes either: each node carries the generation of the
+// search that last reached it, and nodes of older generations read as
+// not reached, so starting over costs nothing and the search only writes
+// the nodes it touches. not shared between threads, see local()
+class CarvingWorkspace
+{
+public:
+    CarvingWorkspace () : width(0), generation(0), queue(0) {}
+
+    // a search over a grid width nodes wide and size nodes in all, none of
+    // them reached yet
+    void begin (unsigned _width, size_t size)
+    {
+        width = _width;
+        if (size > stamp.size())
+        {
+            stamp.resize(size, generation);
+            dist.resize(size);
+            moves.resize(size);
+        }
+        // once in 2^32 searches every stamp could be mistaken for a new one
+        if (++generation == 0)
+        {
+            std::fill(stamp.begin(), stamp.end(), 0);
+            generation = 1;
+        }
+    }
+
+    unsigned distance (size_t n) const { return stamp[n] == generation ? dist[n] : UINT_MAX; }
+    unsigned char move (size_t n) const { return stamp[n] == generation ? moves[n] : (unsigned char)SearchGrid::NoMove; }
+    unsigned char move (unsigned x, unsigned y) const { return move(static_cast<size_t>(y) * width + x); }
+    void reach (size_t n, unsigned d, unsigned char m)
+    {
+        stamp[n] = generation;
+        dist[n] = d;
+        moves[n] = m;
+    }
+
+    // the bucket queue, empty and taking edges up to maxWeight
+    BucketQueue<unsigned>& emptyQueue (unsigned maxWeight)
+    {
+        queue.reset(maxWeight);
+        return queue;
+    }
+
+    // the workspace of the calling thread, made on its first use and kept
+    // until the thread ends. the searches on the thread pool each get the
+    // one of their thread
+    static CarvingWorkspace& local ()
+    {
+        static QThreadStorage<CarvingWorkspace*> workspaces;
+        if (!workspaces.hasLocalData())
+            workspaces.setLocalData(new CarvingWorkspace);
+        return *workspaces.localData();
+    }
+
+    // energy and region windows of the searches, resized as they need.
+    // resizing keeps the storage and leaves the values, so whoever resizes
+    // them writes every cell
+    Grid<short> energy;
+    Grid<unsigned char> mask;
+
+private:
+    unsigned width;
+    unsigned generation;
+    std::vector<unsigned> stamp;
+    std::vector<unsigned> dist;
+    std::vector<unsigned char> moves;
+    BucketQueue<unsigned> queue;
+};
+
+
+#endif /* defined(____PCarvingWorkspace__) */
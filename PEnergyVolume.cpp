@@ -0,0 +1,323 @@
+//
+//  PEnergyVolume.cpp
+//
+//  Per-volume cache of the features the carving energies are made of.
+//
+
+#include "PEnergyVolume.h"
+#include <QMutex>
+#include <QtConcurrentMap>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CARVING_AVX2
+#include <immintrin.h>
+#endif
+
+// g = sqrt(((huL - huR)/2)^2 + ((huU - huD)/2)^2 + ((huF - huB)/2)^2) rounded
+// down, the integer halving as dijkstra2DEx always had it. the sum is taken
+// unsigned as three squares may pass INT_MAX, and g saturates at SHRT_MAX
+static inline short gradientMagnitude ( int dx, int dy, int dz )
+{
+    unsigned n = (unsigned)((dx/2)*(dx/2)) + (unsigned)((dy/2)*(dy/2)) + (unsigned)((dz/2)*(dz/2));
+    unsigned g = static_cast<unsigned>(sqrt((double)n));
+    return static_cast<short>(std::min(g, (unsigned)SHRT_MAX));
+}
+
+// one row of the gradient, x in [begin, end). row, rowU and rowD are the
+// rows y, y+1 and y-1, rowF and rowB those of slices z+1 and z-1; the 2D
+// gradient passes row for both, which zeroes the z difference
+static void gradientRow ( const short* row, const short* rowU, const short* rowD
+                        , const short* rowF, const short* rowB, int width, int begin, int end, short* out )
+{
+    for (int x = begin; x < end; x++)
+        out[x] = gradientMagnitude(row[std::max(x - 1, 0)] - row[std::min(x + 1, width - 1)]
+                                  , rowU[x] - rowD[x], rowF[x] - rowB[x]);
+}
+
+#ifdef CARVING_AVX2
+static bool cpuHasAVX2 ()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// (a - b)/2 rounded towards zero, on 8 sign extended shorts
+__attribute__((target("avx2")))
+static inline __m256i halfDifference ( __m128i a, __m128i b )
+{
+    __m256i d = _mm256_sub_epi32(_mm256_cvtepi16_epi32(a), _mm256_cvtepi16_epi32(b));
+    return _mm256_srai_epi32(_mm256_add_epi32(d, _mm256_srli_epi32(d, 31)), 1);
+}
+
+// the same magnitude as gradientMagnitude for 8 voxels. the square root is
+// taken in float and then corrected by one either way, so the result is
+// exactly the rounded down root the scalar code gives
+__attribute__((target("avx2")))
+static inline __m256i gradientMagnitude8 ( __m128i L, __m128i R, __m128i U, __m128i D, __m128i F, __m128i B )
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    __m256i hx = halfDifference(L, R);
+    __m256i hy = halfDifference(U, D);
+    __m256i hz = halfDifference(F, B);
+    __m256i n = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(hx, hx), _mm256_mullo_epi32(hy, hy))
+                                , _mm256_mullo_epi32(hz, hz));
+    
+    // n is unsigned, halve it to convert and double it back
+    __m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(n, 1)), _mm256_set1_ps(2.0f));
+    __m256i r = _mm256_cvttps_epi32(_mm256_sqrt_ps(f));
+    
+    // r*r > n: one less. (r+1)^2 <= n: one more. compared unsigned
+    __m256i r2 = _mm256_mullo_epi32(r, r);
+    r = _mm256_sub_epi32(r, _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_max_epu32(r2, n), n), one));
+    __m256i r1 = _mm256_add_epi32(r, one);
+    r2 = _mm256_mullo_epi32(r1, r1);
+    r = _mm256_sub_epi32(r, _mm256_cmpeq_epi32(_mm256_max_epu32(r2, n), n));
+    return r;
+}
+
+// gradientRow for 16 voxels per step over the inside of the row, the border
+// voxels and the tail are left to the scalar code
+__attribute__((target("avx2")))
+static void gradientRowAVX2 ( const short* row, const short* rowU, const short* rowD
+                            , const short* rowF, const short* rowB, int width, short* out )
+{
+    int x = 1;
+    for (; x + 16 < width; x += 16)
+    {
+        __m256i L = _mm256_loadu_si256((const __m256i*)(row + x - 1));
+        __m256i R = _mm256_loadu_si256((const __m256i*)(row + x + 1));
+        __m256i U = _mm256_loadu_si256((const __m256i*)(rowU + x));
+        __m256i D = _mm256_loadu_si256((const __m256i*)(rowD + x));
+        __m256i F = _mm256_loadu_si256((const __m256i*)(rowF + x));
+        __m256i B = _mm256_loadu_si256((const __m256i*)(rowB + x));
+        __m256i lo = gradientMagnitude8(_mm256_castsi256_si128(L), _mm256_castsi256_si128(R)
+                                       , _mm256_castsi256_si128(U), _mm256_castsi256_si128(D)
+                                       , _mm256_castsi256_si128(F), _mm256_castsi256_si128(B));
+        __m256i hi = gradientMagnitude8(_mm256_extracti128_si256(L, 1), _mm256_extracti128_si256(R, 1)
+                                       , _mm256_extracti128_si256(U, 1), _mm256_extracti128_si256(D, 1)
+                                       , _mm256_extracti128_si256(F, 1), _mm256_extracti128_si256(B, 1));
+        // saturate to short, packing works per 128 bit lane so put the
+        // quarters back in order
+        __m256i g = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)(out + x), g);
+    }
+    gradientRow(row, rowU, rowD, rowF, rowB, width, 0, 1, out);
+    gradientRow(row, rowU, rowD, rowF, rowB, width, x, width, out);
+}
+#endif
+
+// how the voxels of a volume become features. integer volumes whose values
+// all fit in a short are read as they are, so the energies keep the units of
+// the scan. any other volume, floating point or integers past the range of
+// short, is mapped linearly from its own range onto [0, SHRT_MAX] first:
+// a float volume in [0, 1] or unsigned shorts up to 65535 keep their contrast
+struct FeatureScale
+{
+    bool identity;
+    double low;
+    double scale;
+    FeatureScale () : identity(true), low(0), scale(1) {}
+};
+
+// the scale of the voxels vxl[0, size), one pass over them unless every
+// value of T fits in a short anyway. nans are left out of the range
+template<typename T>
+static FeatureScale featureScale ( const T* vxl, size_t size )
+{
+    FeatureScale s;
+    if (std::numeric_limits<T>::is_integer && std::numeric_limits<T>::min() >= SHRT_MIN
+        && std::numeric_limits<T>::max() <= SHRT_MAX)
+        return s;
+    double low = std::numeric_limits<double>::max();
+    double high = -low;
+    for (size_t n = 0; n < size; n++)
+    {
+        double d = static_cast<double>(vxl[n]);
+        if (d < low)
+            low = d;
+        if (d > high)
+            high = d;
+    }
+    if (low > high)
+        return s; // all nan, or empty
+    if (std::numeric_limits<T>::is_integer && low >= SHRT_MIN && high <= SHRT_MAX)
+        return s;
+    s.identity = false;
+    s.low = low;
+    s.scale = high > low ? SHRT_MAX / (high - low) : 0;
+    return s;
+}
+
+// a voxel of any scalar type as a feature value: scaled, rounded to the
+// nearest integer and clamped to the range of short, nan reads as 0
+template<typename T>
+static inline short toFeature ( T v, const FeatureScale& s )
+{
+    double d = static_cast<double>(v);
+    if (d != d)
+        return 0;
+    if (!s.identity)
+        d = (d - s.low) * s.scale;
+    if (d <= SHRT_MIN)
+        return SHRT_MIN;
+    if (d >= SHRT_MAX)
+        return SHRT_MAX;
+    return static_cast<short>(floor(d + 0.5));
+}
+
+template<>
+inline short toFeature<short> ( short v, const FeatureScale& )
+{
+    return v;
+}
+
+// a row of the volume as features. shorts are read in place, any other type
+// is converted into buf, one row at a time, so the feature grid is the only
+// volume-sized buffer whatever the scalar type
+template<typename T>
+static const short* featureRow ( const T* src, int width, short* buf, const FeatureScale& scale )
+{
+    for (int x = 0; x < width; x++)
+        buf[x] = toFeature(src[x], scale);
+    return buf;
+}
+
+static const short* featureRow ( const short* src, int width, short*, const FeatureScale& )
+{
+    return src;
+}
+
+// fills the feature of one slice, slices are independent so they run on
+// the thread pool. T is the scalar type of the volume
+template<typename T>
+struct FeatureSlice
+{
+    typedef void result_type;
+    const T* vxl;
+    Grid<short>* grid;
+    EnergyFeature feature;
+    FeatureScale scale;
+    bool avx2;
+    FeatureSlice (const T* _vxl, Grid<short>& _grid, EnergyFeature _feature, const FeatureScale& _scale, bool _avx2)
+    : vxl(_vxl), grid(&_grid), feature(_feature), scale(_scale), avx2(_avx2) {}
+    void operator() (int z) const
+    {
+        int width = grid->width;
+        int height = grid->height;
+        int depth = grid->depth;
+        size_t area = static_cast<size_t>(width) * height;
+        const T* slice = vxl + z * area;
+        short* out = &(*grid)(0, 0, z);
+        
+        if (feature == IntensityFeature)
+        {
+            for (size_t n = 0; n < area; n++)
+                out[n] = toFeature(slice[n], scale);
+            return;
+        }
+        
+        // the neighbours are clamped at the border of the volume
+        const T* sliceF = slice;
+        const T* sliceB = slice;
+        if (feature == Gradient3DFeature)
+        {
+            sliceF = vxl + std::min(z + 1, depth - 1) * area;
+            sliceB = vxl + std::max(z - 1, 0) * area;
+        }
+        std::vector<short> buf(5 * width);
+        for (int y = 0; y < height; y++)
+        {
+            const short* row = featureRow(slice + y * width, width, &buf[0], scale);
+            const short* rowU = featureRow(slice + std::min(y + 1, height - 1) * width, width, &buf[width], scale);
+            const short* rowD = featureRow(slice + std::max(y - 1, 0) * width, width, &buf[2 * width], scale);
+            const short* rowF = row;
+            const short* rowB = row;
+            if (feature == Gradient3DFeature)
+            {
+                rowF = featureRow(sliceF + y * width, width, &buf[3 * width], scale);
+                rowB = featureRow(sliceB + y * width, width, &buf[4 * width], scale);
+            }
+#ifdef CARVING_AVX2
+            if (avx2)
+            {
+                gradientRowAVX2(row, rowU, rowD, rowF, rowB, width, out + y * width);
+                continue;
+            }
+#endif
+            gradientRow(row, rowU, rowD, rowF, rowB, width, 0, width, out + y * width);
+        }
+    }
+};
+
+template<typename T>
+static void computeFeature ( const T* vxl, Grid<short>& grid, EnergyFeature feature, bool avx2, FeatureScale& scale )
+{
+    std::vector<int> slices(grid.depth);
+    for (unsigned z = 0; z < grid.depth; z++)
+        slices[z] = z;
+    scale = featureScale(vxl, grid.size());
+    QtConcurrent::blockingMap(slices.begin(), slices.end(), FeatureSlice<T>(vxl, grid, feature, scale, avx2));
+}
+
+struct CachedFeature
+{
+    vtkImageData *data;
+    unsigned long mtime;
+    QSharedPointer<const Grid<short> > grid;
+    FeatureScale scale;
+    CachedFeature () : data(NULL), mtime(0) {}
+    EnergyView view () const
+    {
+        return scale.identity ? EnergyView(grid) : EnergyView(grid, scale.low, scale.scale);
+    }
+};
+
+static QMutex cacheMutex;
+static CachedFeature cache[3]; // one per EnergyFeature
+
+EnergyView energyVolume ( vtkImageData *data, EnergyFeature feature )
+{
+    QMutexLocker lock(&cacheMutex);
+    
+    int dims [3];
+    data->GetDimensions(dims);
+    unsigned long mtime = data->GetMTime();
+    
+    CachedFeature& entry = cache[feature];
+    if (entry.data == data && entry.mtime == mtime && !entry.grid.isNull()
+        && (int)entry.grid->width == dims[0] && (int)entry.grid->height == dims[1]
+        && (int)entry.grid->depth == dims[2])
+        return entry.view();
+    
+    // a new volume replaces the cached one of every feature
+    for (int f = 0; f < 3; f++)
+        if (cache[f].data != data)
+            cache[f] = CachedFeature();
+    
+    Grid<short>* grid = new Grid<short>(dims[0], dims[1], dims[2]);
+    bool avx2 = false;
+#ifdef CARVING_AVX2
+    avx2 = cpuHasAVX2();
+#endif
+    // one specialised pass per scalar type, straight from the scalars
+    const void* scalars = data->GetScalarPointer();
+    FeatureScale scale;
+    switch (data->GetScalarType())
+    {
+        vtkTemplateMacro(computeFeature(static_cast<const VTK_TT*>(scalars), *grid, feature, avx2, scale));
+        default:
+            std::cout << "energyVolume: unsupported scalar type "
+                      << data->GetScalarTypeAsString() << std::endl;
+    }
+    
+    entry.data = data;
+    entry.mtime = mtime;
+    entry.grid = QSharedPointer<const Grid<short> >(grid);
+    entry.scale = scale;
+    return entry.view();
+}
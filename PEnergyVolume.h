@@ -0,0 +1,70 @@
+//
+//  PEnergyVolume.h
+//
+//  Per-volume cache of the features the carving energies are made of.
+//
+
+#ifndef ____PEnergyVolume__
+#define ____PEnergyVolume__
+
+#include "vtkImageData.h"
+#include "PCarvingGrid.h"
+#include <QSharedPointer>
+
+
+// the per-voxel feature behind a carving energy. each routine turns it into
+// the energy of its own box as (offset - feature), the offset being the box
+// maximum or a constant, so one feature volume serves all of them.
+// features are shorts whatever the scalar type of the volume. integer
+// volumes whose values fit in a short are read as they are, any other one,
+// floating point or integers past that range, is first mapped linearly from
+// its range onto [0, SHRT_MAX]
+enum EnergyFeature
+{
+    IntensityFeature, // the voxel value itself
+    GradientFeature,  // in-slice central difference gradient magnitude
+    Gradient3DFeature // the same with the difference along z added
+};
+
+
+// read-only view of the feature of a whole volume, indexed like the voxels.
+// the view shares the data with the cache, so it stays valid while the
+// cache moves on to a newer version of the volume
+class EnergyView
+{
+public:
+    EnergyView () : featureLow(0), featureScale(1) {}
+    EnergyView (const QSharedPointer<const Grid<short> >& _grid, double _low = 0, double _scale = 1)
+    : grid(_grid), featureLow(_low), featureScale(_scale) {}
+    
+    short operator() (int x, int y, int z) const { return (*grid)(x, y, z); }
+    // row y of slice z, x runs fastest
+    const short* row (int y, int z) const { return &(*grid)(0, y, z); }
+    
+    int width () const { return grid->width; }
+    int height () const { return grid->height; }
+    int depth () const { return grid->depth; }
+    
+    // the map of the voxels onto the feature range, (voxel - low) * scale,
+    // low 0 and scale 1 for volumes read as they are. it follows the range
+    // of the whole volume, so an edit anywhere may change every feature:
+    // whoever keeps energies across edits compares it before reusing them
+    double low () const { return featureLow; }
+    double scale () const { return featureScale; }
+
+private:
+    QSharedPointer<const Grid<short> > grid;
+    double featureLow;
+    double featureScale;
+};
+
+
+// the feature of data, computed once on the thread pool and cached until the
+// MTime of data changes: whatever writes into the scalars must call
+// data->Modified(). only the volume asked for last is kept. the gradients
+// run 16 voxels at a time with AVX2 when the cpu has it.
+// safe to call from several threads
+EnergyView energyVolume ( vtkImageData *data, EnergyFeature feature );
+
+
+#endif /* defined(____PEnergyVolume__) */
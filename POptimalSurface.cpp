@@ -0,0 +1,544 @@
+//
+//  POptimalSurface.cpp
+//
+//  Minimum energy surface of a box by max-flow, condition 2 of vision/carving.tex.
+//
+
+#include "POptimalSurface.h"
+#include "PEnergyVolume.h"
+#include <QTime>
+#include <algorithm>
+#include <climits>
+
+
+// the graph of Wu and Chen over a box of columns (u, v) and heights h, node
+// n = (v * U + u) * H + h so that columns are contiguous. every node has up
+// to five infinite arcs out, 0 to the node below it and 1 - 4 to the node
+// smooth below it in the columns at u + 1, u - 1, v + 1 and v - 1. arcs 5 - 9
+// of a node are those arcs of its neighbours coming into it, so the residual
+// of an infinite arc backwards is its flow, and that is all that is stored.
+// the terminal arcs are one signed residual per node, positive from the
+// source and negative to the sink, as Kolmogorov's maxflow keeps them
+class SurfaceGraph
+{
+public:
+    SurfaceGraph (int _U, int _V, int _H, int _smooth);
+    
+    qint64& terminal (unsigned n) { return tr[n]; }
+    qint64 maxflow ();
+    // after maxflow, whether n is under the surface
+    bool sourceSide (unsigned n) const { return parent[n] != NoParent && tree[n] == SourceTree; }
+    double bytesPerNode () const;
+    
+private:
+    enum { Terminal = 10, Orphan = 11, NoParent = 12 };
+    enum { SourceTree = 0, SinkTree = 1 };
+    enum { NoNode = UINT_MAX };
+    static const qint64 Infinite = Q_INT64_C(1) << 60;
+    
+    // the node at the other end of each arc of n, NoNode past the box
+    void neighbours ( unsigned n, unsigned* q ) const;
+    // the other end of an arc known to exist, such as a parent arc
+    unsigned along ( unsigned n, int k ) const { return n + offset[k]; }
+    // residual of arc k of n out of n, and into n
+    qint64 residualOut ( unsigned n, int k, unsigned q ) const;
+    qint64 residualIn ( unsigned n, int k, unsigned q ) const;
+    // push f along arc k of n out of n, or into n when f is negative
+    void push ( unsigned n, int k, unsigned q, qint64 f );
+    static int reverse ( int k ) { return k == 0 ? 5 : k == 5 ? 0 : k < 5 ? 5 + opposite(k) : opposite(k - 5); }
+    static int opposite ( int d ) { return d == 1 ? 2 : d == 2 ? 1 : d == 3 ? 4 : 3; }
+    
+    void activate ( unsigned n );
+    unsigned nextActive ();
+    qint64 augment ( unsigned s, int k, unsigned t );
+    void adopt ( unsigned n );
+    void orphan ( unsigned n );
+    
+    int U, V, H, smooth;
+    unsigned count;
+    int offset[10];
+    std::vector<qint64> flow;  // 5 per node
+    std::vector<qint64> tr;
+    std::vector<int> stamp;
+    std::vector<int> dist;
+    std::vector<unsigned> next; // active list, NoNode when not in it
+    std::vector<unsigned char> parent;
+    std::vector<unsigned char> tree;
+    unsigned firstActive;
+    unsigned lastActive;
+    std::vector<unsigned> orphans;
+    int time;
+};
+
+SurfaceGraph::SurfaceGraph (int _U, int _V, int _H, int _smooth)
+: U(_U), V(_V), H(_H), smooth(_smooth), count(unsigned(_U) * _V * _H)
+, flow(5 * count, 0), tr(count, 0), stamp(count, 0), dist(count, 0), next(count, NoNode)
+, parent(count, NoParent), tree(count, SourceTree), firstActive(NoNode), lastActive(NoNode), time(0)
+{
+    offset[0] = -1;
+    offset[1] = H - smooth;
+    offset[2] = -H - smooth;
+    offset[3] = U * H - smooth;
+    offset[4] = -U * H - smooth;
+    for (int k = 0; k < 5; k++)
+        offset[reverse(k)] = -offset[k];
+}
+
+double SurfaceGraph::bytesPerNode () const
+{
+    return 5 * sizeof(qint64) + sizeof(qint64) + 2 * sizeof(int) + sizeof(unsigned) + 2;
+}
+
+void SurfaceGraph::neighbours ( unsigned n, unsigned* q ) const
+{
+    int h = n % H;
+    unsigned c = n / H;
+    int u = c % U;
+    int v = c / U;
+    bool up = h + smooth < H;
+    bool down = h >= smooth;
+    q[0] = h > 0 ? n - 1 : NoNode;
+    q[5] = h < H - 1 ? n + 1 : NoNode;
+    q[1] = down && u + 1 < U ? n + offset[1] : NoNode;
+    q[2] = down && u > 0 ? n + offset[2] : NoNode;
+    q[3] = down && v + 1 < V ? n + offset[3] : NoNode;
+    q[4] = down && v > 0 ? n + offset[4] : NoNode;
+    q[6] = up && u + 1 < U ? n + offset[6] : NoNode;
+    q[7] = up && u > 0 ? n + offset[7] : NoNode;
+    q[8] = up && v + 1 < V ? n + offset[8] : NoNode;
+    q[9] = up && v > 0 ? n + offset[9] : NoNode;
+}
+
+qint64 SurfaceGraph::residualOut ( unsigned n, int k, unsigned q ) const
+{
+    return k < 5 ? Infinite : flow[5 * q + reverse(k)];
+}
+
+qint64 SurfaceGraph::residualIn ( unsigned n, int k, unsigned q ) const
+{
+    return k < 5 ? flow[5 * n + k] : Infinite;
+}
+
+void SurfaceGraph::push ( unsigned n, int k, unsigned q, qint64 f )
+{
+    if (k < 5)
+        flow[5 * n + k] += f;
+    else
+        flow[5 * q + reverse(k)] -= f;
+}
+
+void SurfaceGraph::activate ( unsigned n )
+{
+    if (next[n] != NoNode)
+        return;
+    next[n] = n; // the last one points to itself
+    if (lastActive != NoNode)
+        next[lastActive] = n;
+    else
+        firstActive = n;
+    lastActive = n;
+}
+
+// skips nodes that left the trees since they were activated
+unsigned SurfaceGraph::nextActive ()
+{
+    while (firstActive != NoNode)
+    {
+        unsigned n = firstActive;
+        firstActive = next[n] == n ? NoNode : next[n];
+        if (firstActive == NoNode)
+            lastActive = NoNode;
+        next[n] = NoNode;
+        if (parent[n] != NoParent)
+            return n;
+    }
+    return NoNode;
+}
+
+void SurfaceGraph::orphan ( unsigned n )
+{
+    parent[n] = Orphan;
+    orphans.push_back(n);
+}
+
+qint64 SurfaceGraph::maxflow ()
+{
+    // the arcs down a column are infinite, so the supply of a node can run
+    // down to the demand of the nodes below it before the search starts.
+    // what is left of the supply ends up at the bottom, and far fewer nodes
+    // are left with a terminal arc
+    qint64 total = 0;
+    for (unsigned c = 0; c < count; c += H)
+    {
+        qint64 carry = 0;
+        for (int h = H - 1; h >= 0; h--)
+        {
+            unsigned n = c + h;
+            if (tr[n] < 0 && carry > 0)
+            {
+                qint64 f = std::min(carry, -tr[n]);
+                tr[n] += f;
+                carry -= f;
+                total += f;
+            }
+            if (h > 0 && (carry += std::max(tr[n], qint64(0))) > 0)
+            {
+                tr[n] = std::min(tr[n], qint64(0));
+                flow[5 * n] += carry;
+            }
+        }
+        tr[c] += carry;
+    }
+    
+    for (unsigned n = 0; n < count; n++)
+        if (tr[n] != 0)
+        {
+            tree[n] = tr[n] > 0 ? SourceTree : SinkTree;
+            parent[n] = Terminal;
+            dist[n] = 1;
+            activate(n);
+        }
+    
+    unsigned current = NoNode;
+    while (true)
+    {
+        // grow the trees from the active node until they touch
+        unsigned n = current;
+        if (n == NoNode || parent[n] == NoParent)
+        {
+            n = nextActive();
+            if (n == NoNode)
+                break;
+        }
+        current = NoNode;
+        int bridge = -1;
+        unsigned other = NoNode;
+        unsigned arcs[10];
+        neighbours(n, arcs);
+        for (int k = 0; k < 10 && bridge < 0; k++)
+        {
+            unsigned q = arcs[k];
+            if (q == NoNode)
+                continue;
+            if (tree[n] == SourceTree ? residualOut(n, k, q) == 0 : residualIn(n, k, q) == 0)
+                continue;
+            if (parent[q] == NoParent)
+            {
+                tree[q] = tree[n];
+                parent[q] = reverse(k);
+                stamp[q] = stamp[n];
+                dist[q] = dist[n] + 1;
+                activate(q);
+            }
+            else if (tree[q] != tree[n])
+            {
+                bridge = k;
+                other = q;
+            }
+            else if (stamp[q] <= stamp[n] && dist[q] > dist[n])
+            {
+                // a shorter way to the terminal
+                parent[q] = reverse(k);
+                stamp[q] = stamp[n];
+                dist[q] = dist[n] + 1;
+            }
+        }
+        if (bridge < 0)
+            continue;
+        
+        time++;
+        current = n; // n may have more arcs to the other tree
+        if (tree[n] == SourceTree)
+            total += augment(n, bridge, other);
+        else
+            total += augment(other, reverse(bridge), n);
+        for (unsigned o = 0; o < orphans.size(); o++)
+            adopt(orphans[o]);
+        orphans.clear();
+    }
+    return total;
+}
+
+// the path from the source to s, arc k from s to t, and on to the sink
+qint64 SurfaceGraph::augment ( unsigned s, int k, unsigned t )
+{
+    qint64 f = residualOut(s, k, t);
+    unsigned n = s;
+    while (parent[n] != Terminal)
+    {
+        unsigned q = along(n, parent[n]);
+        f = std::min(f, residualIn(n, parent[n], q));
+        n = q;
+    }
+    f = std::min(f, tr[n]);
+    n = t;
+    while (parent[n] != Terminal)
+    {
+        unsigned q = along(n, parent[n]);
+        f = std::min(f, residualOut(n, parent[n], q));
+        n = q;
+    }
+    f = std::min(f, -tr[n]);
+    
+    push(s, k, t, f);
+    n = s;
+    while (parent[n] != Terminal)
+    {
+        int a = parent[n];
+        unsigned q = along(n, a);
+        push(n, a, q, -f);
+        if (residualIn(n, a, q) == 0)
+            orphan(n);
+        n = q;
+    }
+    tr[n] -= f;
+    if (tr[n] == 0)
+        orphan(n);
+    n = t;
+    while (parent[n] != Terminal)
+    {
+        int a = parent[n];
+        unsigned q = along(n, a);
+        push(n, a, q, f);
+        if (residualOut(n, a, q) == 0)
+            orphan(n);
+        n = q;
+    }
+    tr[n] += f;
+    if (tr[n] == 0)
+        orphan(n);
+    return f;
+}
+
+// a new parent for n in its tree, one still rooted at the terminal and the
+// nearest to it, or n leaves the tree and its children become orphans
+void SurfaceGraph::adopt ( unsigned n )
+{
+    bool source = tree[n] == SourceTree;
+    int best = -1;
+    int bestDist = INT_MAX;
+    unsigned arcs[10];
+    neighbours(n, arcs);
+    for (int k = 0; k < 10; k++)
+    {
+        unsigned q = arcs[k];
+        if (q == NoNode || tree[q] != tree[n] || parent[q] == NoParent)
+            continue;
+        if ((source ? residualIn(n, k, q) : residualOut(n, k, q)) == 0)
+            continue;
+        
+        // walk up from q, up to a node known to be rooted in this round
+        int d = 0;
+        unsigned j = q;
+        while (true)
+        {
+            if (stamp[j] == time)
+            {
+                d += dist[j];
+                break;
+            }
+            int a = parent[j];
+            d++;
+            if (a == Terminal)
+            {
+                stamp[j] = time;
+                dist[j] = 1;
+                break;
+            }
+            if (a == Orphan)
+            {
+                d = INT_MAX;
+                break;
+            }
+            j = along(j, a);
+        }
+        if (d == INT_MAX)
+            continue;
+        if (d < bestDist)
+        {
+            best = k;
+            bestDist = d;
+        }
+        for (j = q; stamp[j] != time; j = along(j, parent[j]))
+        {
+            stamp[j] = time;
+            dist[j] = d--;
+        }
+    }
+    
+    if (best >= 0)
+    {
+        parent[n] = best;
+        stamp[n] = time;
+        dist[n] = bestDist + 1;
+        return;
+    }
+    parent[n] = NoParent;
+    for (int k = 0; k < 10; k++)
+    {
+        unsigned q = arcs[k];
+        if (q == NoNode || tree[q] != tree[n] || parent[q] == NoParent)
+            continue;
+        if ((source ? residualIn(n, k, q) : residualOut(n, k, q)) > 0)
+            activate(q);
+        int a = parent[q];
+        if (a != Terminal && a != Orphan && along(q, a) == n)
+            orphan(q);
+    }
+}
+
+
+// the voxel of column (u, v) at height h
+struct SurfaceBox
+{
+    int lo[3];
+    int axisH, axisU, axisV;
+    int U, V, H;
+    
+    SurfaceBox ( const int voi[6], SurfaceAxis axis )
+    {
+        axisH = axis;
+        axisU = axis == SurfaceAlongX ? 1 : 0;
+        axisV = axis == SurfaceAlongZ ? 1 : 2;
+        for (int a = 0; a < 3; a++)
+            lo[a] = voi[2 * a];
+        U = voi[2 * axisU + 1] - voi[2 * axisU] + 1;
+        V = voi[2 * axisV + 1] - voi[2 * axisV] + 1;
+        H = voi[2 * axisH + 1] - voi[2 * axisH] + 1;
+    }
+    Pos3D voxel ( int u, int v, int h ) const
+    {
+        int p[3];
+        p[axisH] = lo[axisH] + h;
+        p[axisU] = lo[axisU] + u;
+        p[axisV] = lo[axisV] + v;
+        return Pos3D(p[0], p[1], p[2]);
+    }
+};
+
+// the best height field of each slice v on its own, by dynamic programming
+// along u, with the same smooth bound within the slice
+static void stackedSlices ( const EnergyView& intensity, const SurfaceBox& box, int maxI, int smooth
+                          , std::vector<int>& height )
+{
+    int U = box.U, V = box.V, H = box.H;
+    height.assign(U * V, 0);
+    std::vector<qint64> cost(U * H);
+    std::vector<int> from(U * H);
+    for (int v = 0; v < V; v++)
+    {
+        for (int u = 0; u < U; u++)
+            for (int h = 0; h < H; h++)
+            {
+                Pos3D p = box.voxel(u, v, h);
+                qint64 e = maxI - intensity(p.x, p.y, p.z);
+                if (u == 0)
+                {
+                    cost[h] = e;
+                    continue;
+                }
+                int best = std::max(h - smooth, 0);
+                for (int g = best + 1; g <= std::min(h + smooth, H - 1); g++)
+                    if (cost[(u - 1) * H + g] < cost[(u - 1) * H + best])
+                        best = g;
+                cost[u * H + h] = cost[(u - 1) * H + best] + e;
+                from[u * H + h] = best;
+            }
+        int h = std::min_element(cost.begin() + (U - 1) * H, cost.end()) - (cost.begin() + (U - 1) * H);
+        for (int u = U - 1; u >= 0; u--)
+        {
+            height[v * U + u] = h;
+            h = from[u * H + h];
+        }
+    }
+}
+
+POptimalSurface::POptimalSurface (int _smooth, SurfaceAxis _axis)
+: smooth(std::max(_smooth, 0)), axis(_axis)
+{
+}
+
+void POptimalSurface::solve ( vtkImageData *data, const int voi[6], std::vector<Pos3D>& surface
+                            , SurfaceReport* report )
+{
+    surface.clear();
+    EnergyView intensity = energyVolume(data, IntensityFeature);
+    int v0[6];
+    int dims[3] = {intensity.width(), intensity.height(), intensity.depth()};
+    for (int a = 0; a < 3; a++)
+    {
+        v0[2 * a] = std::max(std::min(voi[2 * a], voi[2 * a + 1]), 0);
+        v0[2 * a + 1] = std::min(std::max(voi[2 * a], voi[2 * a + 1]), dims[a] - 1);
+        if (v0[2 * a] > v0[2 * a + 1])
+            return;
+    }
+    SurfaceBox box(v0, axis);
+    int U = box.U, V = box.V, H = box.H;
+    
+    QTime timer;
+    timer.start();
+    int maxI = SHRT_MIN;
+    int minI = SHRT_MAX;
+    for (int v = 0; v < V; v++)
+        for (int u = 0; u < U; u++)
+            for (int h = 0; h < H; h++)
+            {
+                Pos3D p = box.voxel(u, v, h);
+                maxI = std::max(maxI, int(intensity(p.x, p.y, p.z)));
+                minI = std::min(minI, int(intensity(p.x, p.y, p.z)));
+            }
+    
+    // the weight of a node is its energy less the one below it, so that a
+    // column sums to the energy of its top node. the bottom nodes are made
+    // so cheap that every column keeps at least one of them
+    SurfaceGraph graph(U, V, H, smooth);
+    qint64 bottom = maxI - minI + 1;
+    for (int v = 0; v < V; v++)
+        for (int u = 0; u < U; u++)
+        {
+            unsigned n = (unsigned(v) * U + u) * H;
+            qint64 below = bottom;
+            for (int h = 0; h < H; h++, n++)
+            {
+                Pos3D p = box.voxel(u, v, h);
+                qint64 e = maxI - intensity(p.x, p.y, p.z);
+                graph.terminal(n) = below - e; // minus the weight
+                below = e;
+            }
+        }
+    graph.maxflow();
+    
+    for (int v = 0; v < V; v++)
+        for (int u = 0; u < U; u++)
+        {
+            unsigned n = (unsigned(v) * U + u) * H;
+            int h = 0;
+            while (h + 1 < H && graph.sourceSide(n + h + 1))
+                h++;
+            surface.push_back(box.voxel(u, v, h));
+        }
+    
+    if (report)
+    {
+        report->milliseconds = timer.elapsed();
+        report->bytesPerVoxel = graph.bytesPerNode();
+        report->energy = 0;
+        for (unsigned s = 0; s < surface.size(); s++)
+            report->energy += maxI - intensity(surface[s].x, surface[s].y, surface[s].z);
+        
+        timer.start();
+        std::vector<int> stacked;
+        stackedSlices(intensity, box, maxI, smooth, stacked);
+        report->stackedMilliseconds = timer.elapsed();
+        report->stackedEnergy = 0;
+        report->stackedBreaks = 0;
+        for (int v = 0; v < V; v++)
+            for (int u = 0; u < U; u++)
+            {
+                Pos3D p = box.voxel(u, v, stacked[v * U + u]);
+                report->stackedEnergy += maxI - intensity(p.x, p.y, p.z);
+                if (v > 0 && std::abs(stacked[v * U + u] - stacked[(v - 1) * U + u]) > smooth)
+                    report->stackedBreaks++;
+            }
+    }
+}
@@ -0,0 +1,70 @@
+//
+//  POptimalSurface.h
+//
+//  Minimum energy surface of a box by max-flow, condition 2 of vision/carving.tex.
+//
+
+#ifndef ____POptimalSurface__
+#define ____POptimalSurface__
+
+#include "vtkImageData.h"
+#include "PCarvingAlgorithm.h"
+#include <QtGlobal>
+#include <vector>
+
+
+// the axis the surface is a height field along: it crosses each line of
+// voxels of the box parallel to that axis exactly once
+enum SurfaceAxis
+{
+    SurfaceAlongX,
+    SurfaceAlongY,
+    SurfaceAlongZ
+};
+
+
+// what POptimalSurface did next to the stacked slices, which are only solved
+// when a report is asked for. the stacked surface is the best height field of
+// each slice across the last of the other two axes on its own, as stacked
+// dijkstra2D seams would be, so it never costs more but may break the smooth
+// bound between slices. energies are in the energy of the box
+struct SurfaceReport
+{
+    int milliseconds;
+    int stackedMilliseconds;
+    qint64 energy;
+    qint64 stackedEnergy;
+    int stackedBreaks;    // neighbouring columns of two slices further apart than smooth
+    double bytesPerVoxel; // of the max-flow graph
+    SurfaceReport () : milliseconds(0), stackedMilliseconds(0), energy(0), stackedEnergy(0)
+    , stackedBreaks(0), bytesPerVoxel(0) {}
+};
+
+
+// the exact minimum energy surface of a box, with the height of the surface
+// changing by at most smooth voxels between 4-neighbouring columns. this is
+// the optimal surface construction of Wu and Chen: the voxels under the
+// surface form a closed set of a graph, each voxel weighted by the change
+// of energy from the one below it, and the minimum closed set is the source
+// side of a minimum cut, found with the Boykov-Kolmogorov max-flow. the arcs
+// are implied by the layout of the box, only their flows are stored. the
+// energy is the intensity feature taken from the maximum of the box, as
+// carveRegion2D has it, bright voxels are cheap
+class POptimalSurface
+{
+public:
+    POptimalSurface (int _smooth = 2, SurfaceAxis _axis = SurfaceAlongX);
+    
+    // the surface of the box voi = {x0, x1, y0, y1, z0, z1} in voxel index,
+    // as vtkExtractVOI takes it. surface has one voxel per column, in voxel
+    // index. the volume is only read
+    void solve ( vtkImageData *data, const int voi[6], std::vector<Pos3D>& surface
+               , SurfaceReport* report = NULL );
+    
+private:
+    int smooth;
+    SurfaceAxis axis;
+};
+
+
+#endif /* defined(____POptimalSurface__) */
@@ -0,0 +1,200 @@
+//
+//  PSurfaceCarver.cpp
+//
+//  Surface carving with end-point constraints, as in vision/carving.tex.
+//
+
+#include "PSurfaceCarver.h"
+#include <QFuture>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <cmath>
+
+
+// a curve of n points as a function of c in [0, 1], taken along the pixels
+// of the curve, which are one apart
+static void sampleCurve ( const std::vector<Pos3D>& curve, int n, std::vector<double>& x, std::vector<double>& y )
+{
+    x.resize(n);
+    y.resize(n);
+    for (int s = 0; s < n; s++)
+    {
+        double t = n > 1 ? s * (curve.size() - 1.0) / (n - 1) : 0;
+        unsigned a = static_cast<unsigned>(t);
+        unsigned b = std::min(a + 1, (unsigned)curve.size() - 1);
+        double f = t - a;
+        x[s] = (1 - f) * curve[a].x + f * curve[b].x;
+        y[s] = (1 - f) * curve[a].y + f * curve[b].y;
+    }
+}
+
+// the squares of half width r around every pixel of the polyline (x, y), in a
+// window of the slice from (x0, y0). consecutive points are joined in steps
+// of at most one pixel, so the band is connected. a pixel of the band is set
+// to one more than its chessboard distance to the polyline
+static void markBand ( const std::vector<double>& x, const std::vector<double>& y, int r
+                     , int x0, int y0, Grid<unsigned char>& band )
+{
+    for (unsigned s = 0; s < x.size(); s++)
+    {
+        unsigned prev = s > 0 ? s - 1 : 0;
+        int steps = static_cast<int>(std::ceil(std::max(std::fabs(x[s] - x[prev]), std::fabs(y[s] - y[prev]))));
+        for (int t = 0; t <= steps; t++)
+        {
+            double f = steps > 0 ? double(t) / steps : 1;
+            int cx = static_cast<int>(floor(x[prev] + f * (x[s] - x[prev]) + 0.5)) - x0;
+            int cy = static_cast<int>(floor(y[prev] + f * (y[s] - y[prev]) + 0.5)) - y0;
+            for (int j = std::max(cy - r, 0); j <= std::min(cy + r, (int)band.height - 1); j++)
+                for (int i = std::max(cx - r, 0); i <= std::min(cx + r, (int)band.width - 1); i++)
+                {
+                    unsigned char g = std::max(std::abs(i - cx), std::abs(j - cy)) + 1;
+                    if (band(i, j) == 0 || g < band(i, j))
+                        band(i, j) = g;
+                }
+        }
+    }
+}
+
+// the curve from b back to a, on their slice, within the rectangle around
+// both widened by margin pixels
+static void carveEnds ( const EnergyView& intensity, const Pos3D& a, const Pos3D& b, int margin
+                      , std::vector<Pos3D>& curve )
+{
+    int x0 = std::max(std::min(a.x, b.x) - margin, 0);
+    int y0 = std::max(std::min(a.y, b.y) - margin, 0);
+    int x1 = std::min(std::max(a.x, b.x) + margin, intensity.width() - 1);
+    int y1 = std::min(std::max(a.y, b.y) + margin, intensity.height() - 1);
+    Grid<unsigned char> region(x1 - x0 + 1, y1 - y0 + 1, 1, 1);
+    carveRegion2D(intensity, region, x0, y0, a, b, curve);
+}
+
+PSurfaceCarver::PSurfaceCarver (int _bound, bool _parallel, bool _balanced)
+: bound(std::min(std::max(_bound, 1), 250)), parallel(_parallel), balanced(_balanced), curves(NULL)
+{
+}
+
+void PSurfaceCarver::carve ( vtkImageData *data, const Pos3D& p1, const Pos3D& p2, const Pos3D& p3, const Pos3D& p4
+                           , std::vector< std::vector<Pos3D> >& surface )
+{
+    double spacing[3];
+    data->GetSpacing(spacing);
+    
+    // the marks in voxel index, as averageRank3D takes its corners
+    Pos3D v1(static_cast<int> (p1.x / spacing[0]), static_cast<int> (p1.y / spacing[1]), static_cast<int> (p1.z / spacing[2]));
+    Pos3D v2(static_cast<int> (p2.x / spacing[0]), static_cast<int> (p2.y / spacing[1]), static_cast<int> (p2.z / spacing[2]));
+    Pos3D v3(static_cast<int> (p3.x / spacing[0]), static_cast<int> (p3.y / spacing[1]), static_cast<int> (p3.z / spacing[2]));
+    Pos3D v4(static_cast<int> (p4.x / spacing[0]), static_cast<int> (p4.y / spacing[1]), static_cast<int> (p4.z / spacing[2]));
+    surface.clear();
+    if (v1.z != v2.z || v3.z != v4.z || v1.z == v3.z)
+    {
+        std::cout << "PSurfaceCarver: p1 and p2 have to lie on one slice, p3 and p4 on another" << std::endl;
+        return;
+    }
+    
+    // the sides, one voxel per slice: the marks at the ends and the voxels
+    // averageRank3D picks on the slices in between, in world units
+    std::vector<Pos3D> world1, world2;
+    averageRank3D(data, p1.x, p1.y, p1.z, p3.x, p3.y, p3.z, world1);
+    averageRank3D(data, p2.x, p2.y, p2.z, p4.x, p4.y, p4.z, world2);
+    side1.assign(1, v1);
+    side2.assign(1, v2);
+    for (unsigned k = 0; k < world1.size(); k++)
+    {
+        side1.push_back(Pos3D(floor(world1[k].x / spacing[0] + 0.5), floor(world1[k].y / spacing[1] + 0.5)
+                             , floor(world1[k].z / spacing[2] + 0.5)));
+        side2.push_back(Pos3D(floor(world2[k].x / spacing[0] + 0.5), floor(world2[k].y / spacing[1] + 0.5)
+                             , floor(world2[k].z / spacing[2] + 0.5)));
+    }
+    side1.push_back(v3);
+    side2.push_back(v4);
+    int last = side1.size() - 1;
+    
+    // the end curves join the marks on their slices, p1 - p2 and p3 - p4
+    intensity = energyVolume(data, IntensityFeature);
+    surface.resize(side1.size());
+    curves = &surface;
+    carveEnds(intensity, side1[0], side2[0], 10, surface[0]);
+    carveEnds(intensity, side1[last], side2[last], 10, surface[last]);
+    if (surface[0].empty() || !(surface[0].front() == v2) || !(surface[0].back() == v1)
+        || surface[last].empty() || !(surface[last].front() == v4) || !(surface[last].back() == v3))
+        std::cout << "PSurfaceCarver: the end curves do not join the marks" << std::endl;
+    carveBetween(0, last);
+    curves = NULL;
+}
+
+void PSurfaceCarver::carveBetween ( int lo, int hi )
+{
+    if (hi - lo < 2)
+        return;
+    int mid = (lo + hi) / 2;
+    carveMiddle(lo, mid, hi);
+    
+    // the halves only read the curves that bound them and write the ones
+    // in between, so they share nothing. a task waited for that has not
+    // started yet is run by the waiting thread instead, which keeps deep
+    // recursions from holding up the pool
+    if (parallel && hi - lo > 3)
+    {
+        QFuture<void> lower = QtConcurrent::run(this, &PSurfaceCarver::carveBetween, lo, mid);
+        carveBetween(mid, hi);
+        lower.waitForFinished();
+    }
+    else
+    {
+        carveBetween(lo, mid);
+        carveBetween(mid, hi);
+    }
+}
+
+// the finite difference of the curves along z is smallest around the mean
+// of the curves below and above, so the middle curve is looked for within
+// bound of that mean. the mean is shifted to the sides of the middle slice,
+// by an amount that runs from the shift at one end to the one at the other
+void PSurfaceCarver::carveMiddle ( int lo, int mid, int hi )
+{
+    const std::vector<Pos3D>& below = (*curves)[lo];
+    const std::vector<Pos3D>& above = (*curves)[hi];
+    std::vector<Pos3D>& curve = (*curves)[mid];
+    const Pos3D& a = side2[mid];
+    const Pos3D& b = side1[mid];
+    if (below.empty() || above.empty())
+    {
+        carveEnds(intensity, b, a, 10, curve);
+        return;
+    }
+    
+    int n = 2 * std::max(below.size(), above.size());
+    std::vector<double> bx, by, ax, ay;
+    sampleCurve(below, n, bx, by);
+    sampleCurve(above, n, ax, ay);
+    std::vector<double> x(n), y(n);
+    for (int s = 0; s < n; s++)
+    {
+        x[s] = (bx[s] + ax[s]) / 2;
+        y[s] = (by[s] + ay[s]) / 2;
+    }
+    double dx0 = a.x - x[0], dy0 = a.y - y[0];
+    double dx1 = b.x - x[n-1], dy1 = b.y - y[n-1];
+    double minX = a.x, maxX = a.x, minY = a.y, maxY = a.y;
+    for (int s = 0; s < n; s++)
+    {
+        double c = n > 1 ? double(s) / (n - 1) : 0;
+        x[s] += (1 - c) * dx0 + c * dx1;
+        y[s] += (1 - c) * dy0 + c * dy1;
+        minX = std::min(minX, x[s]);
+        maxX = std::max(maxX, x[s]);
+        minY = std::min(minY, y[s]);
+        maxY = std::max(maxY, y[s]);
+    }
+    
+    int x0 = std::max(static_cast<int>(floor(minX)) - bound, 0);
+    int y0 = std::max(static_cast<int>(floor(minY)) - bound, 0);
+    int x1 = std::min(static_cast<int>(ceil(maxX)) + bound, intensity.width() - 1);
+    int y1 = std::min(static_cast<int>(ceil(maxY)) + bound, intensity.height() - 1);
+    Grid<unsigned char> band(x1 - x0 + 1, y1 - y0 + 1, 1, 0);
+    markBand(x, y, bound, x0, y0, band);
+    if (balanced)
+        balancedRegion2D(intensity, band, x0, y0, b, a, curve);
+    else
+        carveRegion2D(intensity, band, x0, y0, b, a, curve);
+}
@@ -0,0 +1,54 @@
+//
+//  PSurfaceCarver.h
+//
+//  Surface carving with end-point constraints, as in vision/carving.tex.
+//
+
+#ifndef ____PSurfaceCarver__
+#define ____PSurfaceCarver__
+
+#include "vtkImageData.h"
+#include "PCarvingAlgorithm.h"
+#include "PEnergyVolume.h"
+#include <vector>
+
+
+// the surface spanned by four marks, one curve per slice. p1 and p2 lie on
+// one slice and p3 and p4 on another, p1 - p3 and p2 - p4 are the sides.
+// the curves of the two end slices and the sides are carved first, then the
+// curve of the middle slice between two known ones is carved within bound
+// voxels of their mean, bent to meet the sides there, and both halves are
+// carved the same way. the halves are independent, one of them goes to the
+// thread pool and the other runs in place, so the surface takes about the
+// total work over the cores plus the depth of the recursion. balanced
+// carves the middle curves by step b' instead, trading cost for staying
+// near the mean, see balancedRegion2D
+class PSurfaceCarver
+{
+public:
+    PSurfaceCarver (int _bound = 3, bool _parallel = true, bool _balanced = false);
+    
+    // the marks are in world units like dijkstra3D, surface is one curve per
+    // slice from the slice of p1 and p2 to the one of p3 and p4, both
+    // included, each curve in voxel index and from the second side back to
+    // the first: the first curve runs from p2 to p1, the last from p4 to p3.
+    // the volume is only read
+    void carve ( vtkImageData *data, const Pos3D& p1, const Pos3D& p2, const Pos3D& p3, const Pos3D& p4
+               , std::vector< std::vector<Pos3D> >& surface );
+    
+private:
+    // carves the curves strictly between the known curves lo and hi
+    void carveBetween ( int lo, int hi );
+    void carveMiddle ( int lo, int mid, int hi );
+    
+    int bound;
+    bool parallel;
+    bool balanced;
+    EnergyView intensity;
+    std::vector<Pos3D> side1;
+    std::vector<Pos3D> side2;
+    std::vector< std::vector<Pos3D> >* curves;
+};
+
+
+#endif /* defined(____PSurfaceCarver__) */
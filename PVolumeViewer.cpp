@@ -788,6 +788,7 @@ void PVolumeViewer::updateViewers()
     if (!loaded)
         return;
         
+    updateOverlays();
     transViewer->UpdateDisplayExtent();
     transViewer->Render();
     coronalViewer->UpdateDisplayExtent();
@@ -1242,8 +1243,13 @@ void PVolumeViewerCallback::Execute(vtkObject *caller,
         GetRenderWindow()->GetInteractor();
     vtkInteractorStyle *style = vtkInteractorStyle::SafeDownCast(
         interactor->GetInteractorStyle());
+    bool capture = dview->capturesPicks(viewer);
         
-    if (!dview->setCrossHairAction->isChecked())
+    if (capture)
+    {
+        // Button events are handled by pickEvent below
+    }
+    else if (!dview->setCrossHairAction->isChecked())
     {
         if (eventId == vtkCommand::LeftButtonPressEvent)
         {
@@ -1337,8 +1343,15 @@ void PVolumeViewerCallback::Execute(vtkObject *caller,
     
     if (cell)
     {
+        if (capture)
+        {
+            dview->pickEvent(viewer, eventId, pos);
+            if (eventId != vtkCommand::MouseMoveEvent)
+                return;
+        }
+        
         if (dview->setCrossHairAction->isChecked() &&
-            dview->crossHairOn)
+            dview->crossHairOn && !capture)
         {
             dview->updateCrossHairs(viewer, pos);
             return;
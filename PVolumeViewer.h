@@ -168,6 +168,17 @@ protected:
     void setCoronalCrossHair();
     void setSagittalCrossHair();
     void updateCrossHairs(vtkImageViewer2 *viewer, double *pos);
+    
+    // Picks for tools that work on the slices. The left button events
+    // of a viewer whose picks are captured go to pickEvent, with the
+    // world coordinates of the pick, instead of the interactor style.
+    virtual bool capturesPicks(vtkImageViewer2 *viewer) { return false; }
+    virtual void pickEvent(vtkImageViewer2 *viewer, unsigned long eventId,
+        double *pos) {}
+    
+    // Tools that draw over the slices refresh their props here, called by
+    // updateViewers before the views are rendered.
+    virtual void updateOverlays() {}
 };
 
 #endif
\ No newline at end of file
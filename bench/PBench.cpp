@@ -0,0 +1,38 @@
+//
+//  PBench.cpp
+//
+//  Command line timings of the carving routines on synthetic volumes.
+//
+
+#include "PBench.h"
+#include <cmath>
+
+vtkImageData* benchVolume ( int nx, int ny, int nz, int noise, unsigned seed )
+{
+    vtkImageData *data = vtkImageData::New();
+    data->SetDimensions(nx, ny, nz);
+    data->SetSpacing(1, 1, 1);
+    data->SetScalarTypeToShort();
+    data->SetNumberOfScalarComponents(1);
+    data->AllocateScalars();
+    
+    short *vxl = (short*) data->GetScalarPointer();
+    unsigned r = seed;
+    for (int z = 0; z < nz; z++)
+        for (int y = 0; y < ny; y++)
+            for (int x = 0; x < nx; x++)
+            {
+                double dx = x - nx / 2.0;
+                double dy = y - ny / 2.0;
+                double dz = z - nz / 2.0;
+                double d = sqrt(dx*dx + dy*dy + dz*dz);
+                int v = d < nx * 0.4 ? 40 : -800;
+                if (d > nx * 0.38 && d < nx * 0.42)
+                    v += 900;
+                r = r * 1103515245u + 12345u;
+                v += (r >> 16) % noise;
+                *vxl++ = (short) v;
+            }
+    data->Modified();
+    return data;
+}
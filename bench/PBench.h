@@ -0,0 +1,36 @@
+//
+//  PBench.h
+//
+//  Command line timings of the carving routines on synthetic volumes.
+//
+
+#ifndef ____PBench__
+#define ____PBench__
+
+#include "vtkImageData.h"
+
+
+// a short volume of nx x ny x nz voxels, CT-like: a bright shell of radius
+// 0.4 nx around the centre, soft tissue inside and air outside, plus noise
+// below noise. spacing 1, so world units are voxel index. the caller
+// deletes it
+vtkImageData* benchVolume ( int nx, int ny, int nz, int noise = 200, unsigned seed = 12345 );
+
+// the benchmarks, each takes the arguments after its name and returns the
+// exit status of the program
+
+// dijkstra2D on a slice and dijkstra3D on a cube, the searches of the
+// bucket queue. with "set" the same searches also run with the std::set
+// queue they had before, which takes minutes past a 128^3 cube
+int benchQueue ( int argc, char** argv );
+
+// averageRank3D over the slices of a box of uniform noise, the ranking of
+// the candidates of each slice
+int benchRank ( int argc, char** argv );
+
+// POptimalSurface against the stacked slices of its SurfaceReport, on boxes
+// of three sizes around a tilted bright plane
+int benchSurface ( int argc, char** argv );
+
+
+#endif /* defined(____PBench__) */
@@ -0,0 +1,178 @@
+//
+//  PBenchQueue.cpp
+//
+//  Timings of the bucket queue searches of dijkstra2D and dijkstra3D.
+//
+
+#include "PBench.h"
+#include "PCarvingAlgorithm.h"
+#include <QTime>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <vector>
+
+// the searches as they were before the bucket queue, kept to time against:
+// std::set ordered by coordinate is the queue, so nodes pop in coordinate
+// order rather than by distance and are relaxed again until nothing
+// changes. they return the distance of the target over the same graphs
+// and energies as dijkstra2D and dijkstra3D
+
+// the 4-connected grid from (0, 0), moving into a pixel costs its energy
+static unsigned setSearch2D ( const Grid<short>& energy, int tx, int ty )
+{
+    int width = energy.width;
+    int height = energy.height;
+    Grid<unsigned> distance(width, height, 1, UINT_MAX);
+    distance(0, 0) = 0;
+    std::set<Pos> queue;
+    queue.insert(Pos(0, 0));
+    const int dx[4] = { 0, -1, 1, 0 };
+    const int dy[4] = { 1, 0, 0, -1 };
+    while (!queue.empty())
+    {
+        Pos pos = *queue.begin();
+        queue.erase(queue.begin());
+        unsigned d = distance(pos.x, pos.y);
+        for (int c = 0; c < 4; c++)
+        {
+            int x = pos.x + dx[c];
+            int y = pos.y + dy[c];
+            if (x < 0 || x >= width || y < 0 || y >= height)
+                continue;
+            unsigned nd = d + energy(x, y);
+            if (nd < distance(x, y))
+            {
+                distance(x, y) = nd;
+                queue.insert(Pos(x, y));
+            }
+        }
+    }
+    return distance(tx, ty);
+}
+
+// the layered box from corner to corner, one voxel per z, a step of at most
+// stepW in x and y. leaving a voxel costs its energy, which may be negative
+static long setSearch3D ( const Grid<short>& energy, int stepW )
+{
+    int width = energy.width;
+    int height = energy.height;
+    int depth = energy.depth;
+    Grid<long> distance(width, height, depth, LONG_MAX);
+    distance(0, 0, 0) = 0;
+    std::set<Pos3D> queue;
+    queue.insert(Pos3D(0, 0, 0));
+    while (!queue.empty())
+    {
+        Pos3D pos = *queue.begin();
+        queue.erase(queue.begin());
+        if ((int)pos.z + 1 >= depth)
+            continue;
+        long nd = distance(pos.x, pos.y, pos.z) + energy(pos.x, pos.y, pos.z);
+        for (int j = -stepW; j <= stepW; j++)
+            for (int i = -stepW; i <= stepW; i++)
+            {
+                int x = pos.x + i;
+                int y = pos.y + j;
+                if (x < 0 || x >= width || y < 0 || y >= height)
+                    continue;
+                if (nd < distance(x, y, pos.z + 1))
+                {
+                    distance(x, y, pos.z + 1) = nd;
+                    queue.insert(Pos3D(x, y, pos.z + 1));
+                }
+            }
+    }
+    return distance(width - 1, height - 1, depth - 1);
+}
+
+// the seams go into an overlay nobody shows. each seam's cost is summed from
+// the volume the way its search counts it, so that the reference searches,
+// and runs of two trees, can be checked for seams of the same cost
+int benchQueue ( int argc, char** argv )
+{
+    int side = argc > 0 ? atoi(argv[0]) : 256;
+    bool reference = argc > 1 && strcmp(argv[1], "set") == 0;
+    if (side < 2)
+    {
+        std::cout << "queue: the cube side is at least 2" << std::endl;
+        return 1;
+    }
+    
+    // a 512x512 slice with the shell crossing it, corner to corner
+    int n = 512;
+    int x1 = 1, y1 = 1, x2 = n - 2, y2 = n - 2, z = 1;
+    vtkImageData *slice = benchVolume(n + 30, n + 2, 3);
+    CarvingOverlay overlay;
+    CarvingStats stats;
+    QTime timer;
+    timer.start();
+    dijkstra2D(slice, overlay, x1, y1, x2, y2, z, DijkstraSolver, &stats);
+    int elapsed = timer.elapsed();
+    
+    // the window of dijkstra2D and its energy, (window max - voxel) entering
+    // each pixel but the first
+    int dims[3];
+    slice->GetDimensions(dims);
+    const short *vxl = (const short*) slice->GetScalarPointer() + z * dims[0] * dims[1];
+    Grid<short> window(x2 - x1 + 20, y2 - y1 + 1);
+    short maxG = 0;
+    for (unsigned j = 0; j < window.height; j++)
+        for (unsigned i = 0; i < window.width; i++)
+            maxG = std::max(maxG, vxl[(y1 + j) * dims[0] + x1 + i]);
+    for (unsigned j = 0; j < window.height; j++)
+        for (unsigned i = 0; i < window.width; i++)
+            window(i, j) = maxG - vxl[(y1 + j) * dims[0] + x1 + i];
+    const std::vector<Pos3D>& seam = overlay.path(1);
+    unsigned cost = 0;
+    for (unsigned s = 0; s + 1 < seam.size(); s++)
+        cost += window(seam[s].x - x1, seam[s].y - y1);
+    std::cout << "dijkstra2D " << n << "x" << n << ": " << elapsed << " ms, "
+              << stats.settled << " of " << stats.nodes << " nodes settled, "
+              << seam.size() << " voxels, cost " << cost << std::endl;
+    if (reference)
+    {
+        timer.start();
+        unsigned setCost = setSearch2D(window, seam[0].x - x1, seam[0].y - y1);
+        elapsed = timer.elapsed();
+        std::cout << "std::set 2D " << n << "x" << n << ": " << elapsed << " ms, cost " << setCost << std::endl;
+    }
+    slice->Delete();
+    
+    // a cube, corner to corner through the shell, energy 1000 - voxel
+    // leaving each voxel but the last
+    vtkImageData *cube = benchVolume(side, side, side + 1);
+    overlay.clear();
+    stats = CarvingStats();
+    timer.start();
+    dijkstra3D(cube, overlay, 0, 0, 0, side - 1, side - 1, side - 1, DijkstraSolver, 2, &stats);
+    elapsed = timer.elapsed();
+    const short *box = (const short*) cube->GetScalarPointer();
+    size_t area = static_cast<size_t>(side) * side;
+    long boxCost = 0;
+    if (overlay.size())
+        for (unsigned s = 0; s < overlay.path(1).size(); s++)
+        {
+            const Pos3D& p = overlay.path(1)[s];
+            if (p.z != side - 1)
+                boxCost += 1000 - box[p.z * area + p.y * side + p.x];
+        }
+    std::cout << "dijkstra3D " << side << "^3: " << elapsed << " ms, "
+              << stats.settled << " of " << stats.nodes << " nodes settled, "
+              << (overlay.size() ? overlay.path(1).size() : 0) << " voxels, cost " << boxCost << std::endl;
+    if (reference)
+    {
+        Grid<short> energy(side, side, side);
+        for (size_t v = 0; v < energy.size(); v++)
+            energy[v] = 1000 - box[v];
+        timer.start();
+        long setCost = setSearch3D(energy, 2);
+        elapsed = timer.elapsed();
+        std::cout << "std::set 3D " << side << "^3: " << elapsed << " ms, cost " << setCost << std::endl;
+    }
+    cube->Delete();
+    return 0;
+}
@@ -0,0 +1,56 @@
+//
+//  PBenchRank.cpp
+//
+//  Timings of the candidate ranking of averageRank3D.
+//
+
+#include "PBench.h"
+#include "PCarvingAlgorithm.h"
+#include <QTime>
+#include <cstdlib>
+#include <iostream>
+
+// uniform noise rather than benchVolume: every candidate of a slice is
+// ranked whatever the values, and a small value range gives the many ties
+// the counting ranks have to keep. the hash of the picks compares runs of
+// two trees
+int benchRank ( int argc, char** argv )
+{
+    int n = argc > 0 ? atoi(argv[0]) : 128;
+    int depth = argc > 1 ? atoi(argv[1]) : 10;
+    int range = argc > 2 ? atoi(argv[2]) : 1500;
+    if (n < 2 || depth < 3 || range < 1)
+    {
+        std::cout << "rank: the slice side is at least 2, the slices at least 3, the range at least 1" << std::endl;
+        return 1;
+    }
+    
+    vtkImageData *data = vtkImageData::New();
+    data->SetDimensions(n + 4, n + 4, depth + 2);
+    data->SetSpacing(1, 1, 1);
+    data->SetScalarTypeToShort();
+    data->SetNumberOfScalarComponents(1);
+    data->AllocateScalars();
+    short *vxl = (short*) data->GetScalarPointer();
+    unsigned r = 99;
+    for (long i = 0; i < (long)(n + 4) * (n + 4) * (depth + 2); i++)
+    {
+        r = r * 1103515245u + 12345u;
+        vxl[i] = (short)((r >> 16) % range - 300);
+    }
+    data->Modified();
+    
+    std::vector<Pos3D> result;
+    QTime timer;
+    timer.start();
+    averageRank3D(data, n + 1, 1, 1, 2, n, depth, result);
+    int elapsed = timer.elapsed();
+    
+    unsigned long hash = 0;
+    for (unsigned i = 0; i < result.size(); i++)
+        hash = hash * 1000003 + result[i].x * 1000 + result[i].y * 7 + result[i].z;
+    std::cout << "averageRank3D " << n << "x" << n << ", " << result.size() << " picks: "
+              << elapsed << " ms, hash " << hash << std::endl;
+    data->Delete();
+    return 0;
+}
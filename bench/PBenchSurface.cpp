@@ -0,0 +1,65 @@
+//
+//  PBenchSurface.cpp
+//
+//  Timings of the max-flow optimal surface against the stacked slices.
+//
+
+#include "PBench.h"
+#include "POptimalSurface.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+// the plane x = 128 - 0.3 z + 10 sin(0.05 y), blurred over a few voxels, so
+// the surface along x is a smooth height field the stacked slices can only
+// follow slice by slice. off is the mean distance of the surface from it
+int benchSurface ( int argc, char** argv )
+{
+    int noise = argc > 0 ? atoi(argv[0]) : 300;
+    if (noise < 1)
+    {
+        std::cout << "surface: the noise is at least 1" << std::endl;
+        return 1;
+    }
+    
+    int width = 256, height = 256, depth = 130;
+    vtkImageData *data = vtkImageData::New();
+    data->SetDimensions(width, height, depth);
+    data->SetSpacing(1, 1, 1);
+    data->SetScalarTypeToShort();
+    data->SetNumberOfScalarComponents(1);
+    data->AllocateScalars();
+    short *vxl = (short*) data->GetScalarPointer();
+    unsigned r = 5;
+    for (int z = 0; z < depth; z++)
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                r = r * 1103515245u + 12345u;
+                double d = x + 0.3 * z - 128 - 10 * sin(y * 0.05);
+                *vxl++ = (short)(800 * exp(-d * d / 8.0) + (r >> 16) % noise);
+            }
+    data->Modified();
+    
+    int boxes[3][6] = { {80, 150, 40, 103, 10, 41}, {70, 170, 30, 157, 10, 73}, {60, 190, 20, 211, 5, 124} };
+    for (int b = 0; b < 3; b++)
+        for (int smooth = 1; smooth <= 2; smooth++)
+        {
+            const int* voi = boxes[b];
+            SurfaceReport report;
+            std::vector<Pos3D> surface;
+            POptimalSurface(smooth, SurfaceAlongX).solve(data, voi, surface, &report);
+            
+            double off = 0;
+            for (unsigned i = 0; i < surface.size(); i++)
+                off += fabs(surface[i].x + 0.3 * surface[i].z - 128 - 10 * sin(surface[i].y * 0.05));
+            int voxels = (voi[1] - voi[0] + 1) * (voi[3] - voi[2] + 1) * (voi[5] - voi[4] + 1);
+            std::cout << voxels << " voxels, smooth " << smooth << ": cut " << report.milliseconds
+                      << " ms, E " << report.energy << " | stacked " << report.stackedMilliseconds
+                      << " ms, E " << report.stackedEnergy << ", " << report.stackedBreaks << "/"
+                      << surface.size() << " breaks | " << report.bytesPerVoxel << " B/voxel, off "
+                      << (surface.empty() ? 0 : off / surface.size()) << std::endl;
+        }
+    data->Delete();
+    return 0;
+}
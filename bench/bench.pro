@@ -0,0 +1,33 @@
+# carvingbench: command line timings of the carving routines, run from
+# this directory with qmake bench.pro && make, see main.cpp for the usage
+TEMPLATE = app
+TARGET = carvingbench
+CONFIG += console
+CONFIG -= app_bundle
+DESTDIR = ../_make/bench/
+MOC_DIR = ../_make/bench/
+OBJECTS_DIR = ../_make/bench/
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+include(../vtk.pro)
+
+QMAKE_CXXFLAGS += -Wno-unused-variable -fpermissive -Wno-unused-parameter
+
+LIBS += -L/usr/local/lib 
+
+# Input
+HEADERS += PBench.h \
+           ../PCarvingAlgorithm.h \
+           ../PBucketQueue.h \
+           ../PCarvingGrid.h \
+           ../PCarvingWorkspace.h \
+           ../PEnergyVolume.h \
+           ../POptimalSurface.h
+SOURCES += main.cpp \
+           PBench.cpp \
+           PBenchQueue.cpp \
+           PBenchRank.cpp \
+           PBenchSurface.cpp \
+           ../PCarvingAlgorithm.cpp \
+           ../PEnergyVolume.cpp \
+           ../POptimalSurface.cpp
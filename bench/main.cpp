@@ -0,0 +1,28 @@
+// main.cpp of carvingbench
+//
+//  carvingbench queue [cube side] [set]
+//  carvingbench rank [slice side] [slices] [value range]
+//  carvingbench surface [noise]
+//
+// prints the timings of one benchmark, see PBench.h
+
+#include <QCoreApplication>
+#include <cstring>
+#include <iostream>
+#include "PBench.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "queue") == 0)
+        return benchQueue(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "rank") == 0)
+        return benchRank(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "surface") == 0)
+        return benchSurface(argc - 2, argv + 2);
+    
+    std::cout << "usage: carvingbench queue [cube side] [set]" << std::endl
+              << "       carvingbench rank [slice side] [slices] [value range]" << std::endl
+              << "       carvingbench surface [noise]" << std::endl;
+    return 1;
+}
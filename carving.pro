@@ -20,11 +20,20 @@ HEADERS += PBrainExtractor.h \
            PVoiWidget.h \
            PVolumeSegmenter.h \
            PVolumeViewer.h \
-           PCarvingAlgorithm.h
+           PCarvingAlgorithm.h \
+           PBucketQueue.h \
+           PCarvingGrid.h \
+           PCarvingWorkspace.h \
+           PEnergyVolume.h \
+           PSurfaceCarver.h \
+           POptimalSurface.h
 SOURCES += main.cpp \
            PBrainExtractor.cpp \
            PThresholder.cpp \
            PVoiWidget.cpp \
            PVolumeSegmenter.cpp \
            PVolumeViewer.cpp \
-           PCarvingAlgorithm.cpp 
+           PCarvingAlgorithm.cpp \
+           PEnergyVolume.cpp \
+           PSurfaceCarver.cpp \
+           POptimalSurface.cpp